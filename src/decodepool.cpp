@@ -0,0 +1,179 @@
+// decodepool.cpp
+
+#include "decodepool.h"
+#include "imageloader.h"
+
+#include <QThread>
+
+#include <algorithm>
+
+DecodePool::DecodePool(int threadCount, QObject *parent)
+    : QObject(parent)
+{
+    if (threadCount <= 0)
+        threadCount = std::max(2, QThread::idealThreadCount());
+    m_threads.reserve(threadCount);
+    for (int i = 0; i < threadCount; ++i)
+        m_threads.emplace_back(&DecodePool::run, this);
+}
+
+DecodePool::~DecodePool()
+{
+    stop();
+}
+
+QString DecodePool::jobKey(const QString &path, DecodePurpose purpose)
+{
+    return QString::number(static_cast<int>(purpose)) + QLatin1Char(':') + path;
+}
+
+void DecodePool::submit(const QString &path, DecodePurpose purpose, int priority,
+                        QSize targetSize, quint64 generation)
+{
+    const QString key = jobKey(path, purpose);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running)
+            return;
+
+        // A running job that is still wanted just picks up the new
+        // generation. One that has already been told to abort cannot be
+        // revived, so a fresh job is queued behind it instead.
+        auto active = m_active.constFind(key);
+        if (active != m_active.constEnd() && !active.value()->cancelled) {
+            active.value()->generation = qMax(active.value()->generation, generation);
+            return;
+        }
+
+        auto queued = m_queued.find(key);
+        if (queued != m_queued.end()) {
+            // Already waiting: move it to its new position, keeping its
+            // original sequence number so equal priorities stay FIFO.
+            auto node = m_queue.extract(queued.value());
+            node.key().first = priority;
+            node.mapped().targetSize = targetSize;
+            node.mapped().generation = qMax(node.mapped().generation, generation);
+            queued.value() = node.key();
+            m_queue.insert(std::move(node));
+            return;
+        }
+
+        Job job;
+        job.path = path;
+        job.targetSize = targetSize;
+        job.purpose = purpose;
+        job.generation = generation;
+        const Order order(priority, m_sequence++);
+        m_queue.emplace(order, std::move(job));
+        m_queued.insert(key, order);
+    }
+    m_cv.notify_one();
+}
+
+void DecodePool::dropStale(DecodePurpose purpose, quint64 generation)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_queue.begin(); it != m_queue.end(); ) {
+        const Job &job = it->second;
+        if (job.purpose == purpose && job.generation < generation) {
+            m_queued.remove(jobKey(job.path, job.purpose));
+            it = m_queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (const auto &active : std::as_const(m_active)) {
+        if (active->purpose == purpose && active->generation < generation)
+            active->cancelled = true;
+    }
+}
+
+bool DecodePool::cancel(const QString &path, DecodePurpose purpose)
+{
+    const QString key = jobKey(path, purpose);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool found = false;
+    auto active = m_active.constFind(key);
+    if (active != m_active.constEnd()) {
+        active.value()->cancelled = true;
+        found = true;
+    }
+    auto queued = m_queued.find(key);
+    if (queued != m_queued.end()) {
+        m_queue.erase(queued.value());
+        m_queued.erase(queued);
+        found = true;
+    }
+    return found;
+}
+
+void DecodePool::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.clear();
+    m_queued.clear();
+    for (const auto &active : std::as_const(m_active))
+        active->cancelled = true;
+}
+
+void DecodePool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        m_queue.clear();
+        m_queued.clear();
+        for (const auto &active : std::as_const(m_active))
+            active->cancelled = true;
+    }
+    m_cv.notify_all();
+    for (std::thread &t : m_threads) {
+        if (t.joinable())
+            t.join();
+    }
+    m_threads.clear();
+}
+
+void DecodePool::run()
+{
+    while (true) {
+        Job job;
+        QString key;
+        auto state = std::make_shared<ActiveJob>();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]{ return !m_running || !m_queue.empty(); });
+            if (!m_running)
+                break;
+            auto first = m_queue.begin();
+            job = std::move(first->second);
+            m_queue.erase(first);
+            key = jobKey(job.path, job.purpose);
+            m_queued.remove(key);
+            state->purpose = job.purpose;
+            state->generation = job.generation;
+            m_active.insert(key, state);
+        }
+
+        QImage image;
+        switch (job.purpose) {
+        case DecodePurpose::RefineHalf:
+            image = ImageLoader::loadDemosaiced(job.path, /*halfSize=*/true, job.targetSize, &state->cancelled);
+            break;
+        default:
+            image = ImageLoader::load(job.path, job.targetSize, &state->cancelled);
+            break;
+        }
+
+        // Emit while the key is still marked active; this keeps a resubmission
+        // issued during the decode from queueing the same work again.
+        if (!state->cancelled)
+            emit decoded(job.path, static_cast<int>(job.purpose), image);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // A replacement job for the same key may have started meanwhile.
+            if (m_active.value(key) == state)
+                m_active.remove(key);
+        }
+    }
+}
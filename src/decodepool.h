@@ -0,0 +1,111 @@
+// decodepool.h
+//
+// Declares DecodePool, a fixed-size set of worker threads that decode
+// images through ImageLoader. Jobs wait in a priority queue (lower value
+// runs first) and are keyed by path and purpose, so submitting the same
+// image again simply re-prioritises the queued job in place instead of
+// starting another decode.
+//
+// Each job also carries a generation token. When the caller's interest
+// moves on (e.g. the user jumps far away in the list) it resubmits what it
+// still wants with a newer generation and calls dropStale(); everything
+// older is removed from the queue, and jobs already running are aborted
+// cooperatively by ImageLoader at the next opportunity.
+
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <QObject>
+#include <QSize>
+#include <QString>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// What a decode result will be used for. Jobs for the same file but a
+// different purpose are independent and can be queued side by side.
+// RefineHalf is the RAW refinement stage that follows the fast Display
+// decode (embedded preview): a half-size LibRaw demosaic. A full-size stage
+// would only be scaled down to the label as well, so there is none until
+// the viewer can zoom.
+enum class DecodePurpose
+{
+    Display = 0,
+    Thumbnail = 1,
+    RefineHalf = 2
+};
+
+class DecodePool : public QObject
+{
+    Q_OBJECT
+public:
+    // threadCount <= 0 sizes the pool to QThread::idealThreadCount().
+    explicit DecodePool(int threadCount = 0, QObject *parent = nullptr);
+    ~DecodePool() override;
+
+    // Queue a decode of `path`. If a job for the same path and purpose is
+    // already waiting, its priority, target size and generation are updated
+    // in place; if it is already running only its generation is refreshed.
+    void submit(const QString &path, DecodePurpose purpose, int priority,
+                QSize targetSize = QSize(), quint64 generation = 0);
+
+    // Discard queued jobs of `purpose` whose generation is older than
+    // `generation`, and request cancellation of matching running jobs.
+    void dropStale(DecodePurpose purpose, quint64 generation);
+
+    // Remove a queued job and abort it if it is running. Returns false if
+    // it was neither waiting nor running.
+    bool cancel(const QString &path, DecodePurpose purpose);
+
+    // Drop all queued jobs and abort the running ones.
+    void clear();
+
+    // Stop accepting work and join the workers. Called on destruction.
+    void stop();
+
+signals:
+    // Emitted from a worker thread when a job finishes. `purpose` carries a
+    // DecodePurpose value; connect with Qt::QueuedConnection. A null
+    // `image` means the file could not be decoded. Cancelled jobs emit
+    // nothing.
+    void decoded(const QString &path, int purpose, const QImage &image);
+
+private:
+    struct Job
+    {
+        QString path;
+        QSize targetSize;
+        DecodePurpose purpose = DecodePurpose::Display;
+        quint64 generation = 0;
+    };
+    // State shared between the pool and the worker running a job.
+    struct ActiveJob
+    {
+        DecodePurpose purpose = DecodePurpose::Display;
+        quint64 generation = 0;
+        std::atomic_bool cancelled { false };
+    };
+    // Queue order: (priority, submission sequence). The sequence keeps jobs
+    // of equal priority in FIFO order.
+    using Order = std::pair<int, quint64>;
+
+    static QString jobKey(const QString &path, DecodePurpose purpose);
+    void run();
+
+    std::map<Order, Job> m_queue;
+    QHash<QString, Order> m_queued;   // job key -> position in m_queue
+    QHash<QString, std::shared_ptr<ActiveJob>> m_active; // keys being decoded
+    quint64 m_sequence = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_running = true;
+    std::vector<std::thread> m_threads;
+};
@@ -0,0 +1,97 @@
+// directoryscanner.cpp
+
+#include "directoryscanner.h"
+#include "imageloader.h"
+#include "naturalsort.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+
+#include <thread>
+
+DirectoryScanner::DirectoryScanner(QObject *parent)
+    : QObject(parent)
+    , m_link(std::make_shared<Link>())
+{
+    m_link->scanner = this;
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+    cancel();
+    std::lock_guard<std::mutex> lock(m_link->mutex);
+    m_link->scanner = nullptr;
+}
+
+quint64 DirectoryScanner::start(const QString &directory)
+{
+    cancel();
+    const quint64 scanId = ++m_scanId;
+    m_cancelled = std::make_shared<std::atomic_bool>(false);
+    std::thread(&DirectoryScanner::run, directory, scanId, m_cancelled, m_link).detach();
+    return scanId;
+}
+
+void DirectoryScanner::cancel()
+{
+    if (m_cancelled)
+        m_cancelled->store(true);
+    m_cancelled.reset();
+}
+
+void DirectoryScanner::run(const QString &directory, quint64 scanId,
+                           std::shared_ptr<std::atomic_bool> cancelled, std::shared_ptr<Link> link)
+{
+    // Symlinks are skipped, as before, and each name is tested once against
+    // the suffix sets instead of once per glob pattern.
+    QDirIterator it(directory, QDir::Files | QDir::NoSymLinks);
+    QFileInfoList batch;
+    QElapsedTimer sinceFlush;
+    sinceFlush.start();
+    bool firstFlushed = false;
+    int total = 0;
+
+    // Batches that slip out after a cancel carry a stale scan id and are
+    // dropped by the receiver.
+    auto publish = [&](auto &&signal) {
+        std::lock_guard<std::mutex> lock(link->mutex);
+        if (link->scanner && !cancelled->load())
+            signal(link->scanner);
+    };
+
+    auto flush = [&] {
+        if (batch.isEmpty())
+            return;
+        NaturalSort::sort(batch);
+        total += batch.size();
+        publish([&](DirectoryScanner *scanner) { emit scanner->batchReady(scanId, batch); });
+        batch.clear();
+        firstFlushed = true;
+        sinceFlush.restart();
+    };
+
+    while (it.hasNext()) {
+        if (cancelled->load())
+            return;
+        it.next();
+        const QFileInfo fi = it.fileInfo();
+        if (!ImageLoader::isImageFile(fi.fileName()))
+            continue;
+        // Stat here rather than on the GUI thread: the thumbnail store keys
+        // on size and mtime, and QFileInfo caches both once fetched.
+        fi.size();
+        fi.lastModified();
+        batch.append(fi);
+
+        const bool due = firstFlushed
+                             ? sinceFlush.elapsed() >= BATCH_INTERVAL_MS
+                             : (batch.size() >= FIRST_BATCH_FILES || sinceFlush.elapsed() >= FIRST_BATCH_MS);
+        if (due)
+            flush();
+    }
+    if (cancelled->load())
+        return;
+    flush();
+    publish([&](DirectoryScanner *scanner) { emit scanner->finished(scanId, total); });
+}
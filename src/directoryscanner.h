@@ -0,0 +1,67 @@
+// directoryscanner.h
+//
+// Declares DirectoryScanner, which lists the images in a source folder on a
+// background thread. The folder is walked once with a streaming iterator
+// and each entry's extension is matched against the supported formats in
+// the same pass. Matches are published in naturally sorted batches as the
+// walk proceeds: the first batch goes out almost immediately so the window
+// can show an image while a large or remote folder is still being read,
+// later ones at a steady interval.
+
+#pragma once
+
+#include <QFileInfo>
+#include <QObject>
+#include <QString>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+class DirectoryScanner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DirectoryScanner(QObject *parent = nullptr);
+    ~DirectoryScanner() override;
+
+    // Abort any scan in progress and start listing `directory`. Returns the
+    // id carried by this scan's signals; results from earlier scans still in
+    // the event queue carry an older id and should be ignored.
+    quint64 start(const QString &directory);
+
+    // Abort the scan in progress, if any. Returns at once: the scan thread
+    // is detached, may still be blocked in a listing call on a slow share,
+    // and emits nothing more once it gets past it.
+    void cancel();
+
+signals:
+    // Emitted from the scan thread; connect with Qt::QueuedConnection.
+    // `files` is sorted with NaturalSort and holds only new entries.
+    void batchReady(quint64 scanId, const QFileInfoList &files);
+    // Emitted once the whole folder has been listed (not on cancellation).
+    void finished(quint64 scanId, int total);
+
+private:
+    // The scan threads' way back to the scanner, which they share with it.
+    // `scanner` is cleared when the scanner is destroyed; a thread emits
+    // only while holding `mutex` and finding it set.
+    struct Link
+    {
+        std::mutex mutex;
+        DirectoryScanner *scanner = nullptr;
+    };
+
+    static void run(const QString &directory, quint64 scanId,
+                    std::shared_ptr<std::atomic_bool> cancelled, std::shared_ptr<Link> link);
+
+    // The first batch is flushed after FIRST_BATCH_FILES matches or
+    // FIRST_BATCH_MS, whichever comes first; later ones every BATCH_INTERVAL_MS.
+    static constexpr int FIRST_BATCH_FILES = 64;
+    static constexpr int FIRST_BATCH_MS = 50;
+    static constexpr int BATCH_INTERVAL_MS = 250;
+
+    std::shared_ptr<Link> m_link;
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+    quint64 m_scanId = 0;
+};
@@ -0,0 +1,294 @@
+// exifscanner.cpp
+
+#include "exifscanner.h"
+#include "tiffview.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr quint16 TAG_IMAGE_WIDTH = 0x0100;
+constexpr quint16 TAG_IMAGE_HEIGHT = 0x0101;
+constexpr quint16 TAG_MAKE = 0x010F;
+constexpr quint16 TAG_MODEL = 0x0110;
+constexpr quint16 TAG_DATETIME = 0x0132;
+constexpr quint16 TAG_EXPOSURE_TIME = 0x829A;
+constexpr quint16 TAG_FNUMBER = 0x829D;
+constexpr quint16 TAG_EXIF_IFD = 0x8769;
+constexpr quint16 TAG_ISO = 0x8827;
+constexpr quint16 TAG_DATETIME_ORIGINAL = 0x9003;
+constexpr quint16 TAG_FOCAL_LENGTH = 0x920A;
+constexpr quint16 TAG_SUBSEC_ORIGINAL = 0x9291;
+constexpr quint16 TAG_PIXEL_X = 0xA002;
+constexpr quint16 TAG_PIXEL_Y = 0xA003;
+constexpr quint16 TAG_LENS_MODEL = 0xA434;
+
+// Days since 1970-01-01 of a proleptic Gregorian date.
+qint64 daysFromCivil(int y, int m, int d)
+{
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const int yoe = y - era * 400;
+    const int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return qint64(era) * 146097 + doe - 719468;
+}
+
+// Parse "YYYY:MM:DD HH:MM:SS" into milliseconds, or -1.
+qint64 parseExifDateTime(const uchar *p, qint64 length)
+{
+    if (length < 19)
+        return -1;
+    auto num = [p](int at, int digits, int &out) {
+        out = 0;
+        for (int i = 0; i < digits; ++i) {
+            const uchar c = p[at + i];
+            if (c < '0' || c > '9')
+                return false;
+            out = out * 10 + (c - '0');
+        }
+        return true;
+    };
+    int y, mo, d, h, mi, s;
+    if (!num(0, 4, y) || !num(5, 2, mo) || !num(8, 2, d) || !num(11, 2, h) || !num(14, 2, mi) || !num(17, 2, s))
+        return -1;
+    // Cameras with an unset clock write zeros.
+    if (y == 0 || mo < 1 || mo > 12 || d < 1 || d > 31)
+        return -1;
+    return ((daysFromCivil(y, mo, d) * 24 + h) * 60 + mi) * 60000 + qint64(s) * 1000;
+}
+
+// SubSecTime holds the fractional digits ("5" = 500 ms, "123" = 123 ms).
+int parseSubSeconds(const uchar *p, qint64 length)
+{
+    int ms = 0;
+    int digits = 0;
+    for (qint64 i = 0; i < length && digits < 3; ++i) {
+        if (p[i] < '0' || p[i] > '9')
+            break;
+        ms = ms * 10 + (p[i] - '0');
+        ++digits;
+    }
+    if (digits == 0)
+        return 0;
+    while (digits++ < 3)
+        ms *= 10;
+    return ms;
+}
+
+// Value of a RATIONAL field, or 0.
+float readRational(const TiffView &tiff, quint32 ifd, quint16 tag)
+{
+    quint16 type = 0;
+    quint32 count = 0;
+    qint64 at = 0;
+    if (!findTiffTag(tiff, ifd, tag, type, count, at) || type != TIFF_RATIONAL || count == 0)
+        return 0.0f;
+    const quint32 denominator = tiff.u32(at + 4);
+    return denominator ? float(double(tiff.u32(at)) / denominator) : 0.0f;
+}
+
+// Text of an ASCII field with trailing NULs and spaces removed.
+QString readText(const TiffView &tiff, quint32 ifd, quint16 tag)
+{
+    quint16 type = 0;
+    quint32 count = 0;
+    qint64 at = 0;
+    if (!findTiffTag(tiff, ifd, tag, type, count, at) || type != TIFF_ASCII)
+        return QString();
+    const char *text = reinterpret_cast<const char *>(tiff.data + at);
+    qint64 length = qstrnlen(text, count);
+    while (length > 0 && text[length - 1] == ' ')
+        --length;
+    return QString::fromLatin1(text, length);
+}
+
+// Fill `out` from a TIFF structure. Returns true if a capture time was
+// found, which is what decides whether a larger read is worth trying.
+bool parseTiff(const uchar *data, qint64 size, ExifMetadata &out)
+{
+    TiffView tiff { data, size, true };
+    if (size < 8)
+        return false;
+    if (data[0] == 'I' && data[1] == 'I')
+        tiff.littleEndian = true;
+    else if (data[0] == 'M' && data[1] == 'M')
+        tiff.littleEndian = false;
+    else
+        return false;
+    // The magic number after the byte order differs between RAW formats
+    // (42 for TIFF/DNG/NEF/ARW/CR2, "RO" for ORF, 0x55 for RW2), so it is
+    // not checked.
+    const quint32 ifd0 = tiff.u32(4);
+
+    // The body is reported as "Make Model", without repeating the make when
+    // the model already starts with it ("Canon Canon EOS R5").
+    const QString make = readText(tiff, ifd0, TAG_MAKE);
+    const QString model = readText(tiff, ifd0, TAG_MODEL);
+    out.body = model.startsWith(make, Qt::CaseInsensitive) ? model
+                                                           : QStringLiteral("%1 %2").arg(make, model).trimmed();
+    out.width = readTiffUInt(tiff, ifd0, TAG_IMAGE_WIDTH);
+    out.height = readTiffUInt(tiff, ifd0, TAG_IMAGE_HEIGHT);
+
+    quint16 type = 0;
+    quint32 count = 0;
+    qint64 at = 0;
+    if (findTiffTag(tiff, ifd0, TAG_EXIF_IFD, type, count, at)) {
+        const quint32 exifIfd = tiff.u32(at);
+        out.iso = readTiffUInt(tiff, exifIfd, TAG_ISO);
+        out.exposure = readRational(tiff, exifIfd, TAG_EXPOSURE_TIME);
+        out.aperture = readRational(tiff, exifIfd, TAG_FNUMBER);
+        out.focalLength = readRational(tiff, exifIfd, TAG_FOCAL_LENGTH);
+        out.lens = readText(tiff, exifIfd, TAG_LENS_MODEL);
+        // The Exif pixel dimensions describe the main image; IFD0 of a RAW
+        // often describes its thumbnail.
+        if (const quint32 w = readTiffUInt(tiff, exifIfd, TAG_PIXEL_X))
+            out.width = w;
+        if (const quint32 h = readTiffUInt(tiff, exifIfd, TAG_PIXEL_Y))
+            out.height = h;
+        if (findTiffTag(tiff, exifIfd, TAG_DATETIME_ORIGINAL, type, count, at) && type == TIFF_ASCII) {
+            qint64 ms = parseExifDateTime(data + at, count);
+            if (ms >= 0) {
+                if (findTiffTag(tiff, exifIfd, TAG_SUBSEC_ORIGINAL, type, count, at) && type == TIFF_ASCII)
+                    ms += parseSubSeconds(data + at, count);
+                out.captureTime = ms;
+                return true;
+            }
+        }
+    }
+    if (findTiffTag(tiff, ifd0, TAG_DATETIME, type, count, at) && type == TIFF_ASCII)
+        out.captureTime = parseExifDateTime(data + at, count);
+    return out.captureTime >= 0;
+}
+
+bool parseJpeg(const uchar *data, qint64 size, ExifMetadata &out)
+{
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+    qint64 pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF)
+            return false;
+        const uchar marker = data[pos + 1];
+        if (marker == 0xFF) {           // fill byte
+            ++pos;
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9)   // image data: no Exif before it
+            return false;
+        const qint64 length = qint64(data[pos + 2]) << 8 | data[pos + 3];
+        if (length < 2)
+            return false;
+        if (marker == 0xE1 && length >= 8 && pos + 10 <= size
+            && std::memcmp(data + pos + 4, "Exif\0\0", 6) == 0) {
+            const qint64 start = pos + 10;
+            return parseTiff(data + start, qMin(size, pos + 2 + length) - start, out);
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// Modification time on the same wall-clock scale as EXIF times.
+qint64 fileTimeFallback(const QString &path)
+{
+    const QDateTime modified = QFileInfo(path).lastModified();
+    if (!modified.isValid())
+        return 0;
+    return modified.toMSecsSinceEpoch() + qint64(modified.offsetFromUtc()) * 1000;
+}
+
+} // namespace
+
+ExifScanner::ExifScanner(QObject *parent)
+    : QObject(parent)
+{
+}
+
+ExifScanner::~ExifScanner()
+{
+    cancel();
+}
+
+quint64 ExifScanner::start(const QStringList &paths)
+{
+    cancel();
+    const quint64 jobId = ++m_jobId;
+    m_cancelled = std::make_shared<std::atomic_bool>(false);
+    m_thread = std::thread(&ExifScanner::run, this, paths, jobId, m_cancelled);
+    return jobId;
+}
+
+void ExifScanner::cancel()
+{
+    if (m_cancelled)
+        m_cancelled->store(true);
+    if (m_thread.joinable())
+        m_thread.join();
+    m_cancelled.reset();
+}
+
+ExifMetadata ExifScanner::read(const QString &path)
+{
+    ExifMetadata metadata;
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly)) {
+        // The date tags almost always sit in the first few KB; the larger
+        // read is only needed when they point further into the file.
+        for (const qint64 bytes : { FIRST_READ_BYTES, HEADER_BYTES }) {
+            QByteArray header = file.read(bytes);
+            // Fujifilm RAF: the metadata lives in an embedded JPEG whose
+            // offset is stored big-endian at byte 84.
+            if (header.size() >= 88 && header.startsWith("FUJIFILMCCD-RAW")) {
+                const uchar *p = reinterpret_cast<const uchar *>(header.constData()) + 84;
+                const qint64 offset = qint64(p[0]) << 24 | qint64(p[1]) << 16 | qint64(p[2]) << 8 | p[3];
+                header = file.seek(offset) ? file.read(bytes) : QByteArray();
+            }
+            const uchar *data = reinterpret_cast<const uchar *>(header.constData());
+            const qint64 size = header.size();
+            metadata = ExifMetadata();
+            const bool found = size >= 2 && data[0] == 0xFF ? parseJpeg(data, size, metadata)
+                                                            : parseTiff(data, size, metadata);
+            if (found)
+                return metadata;
+            // Everything there was has been read already.
+            if (size < bytes || !file.seek(0))
+                break;
+        }
+    }
+    // No usable capture time (PNG, CR3's ISO container, stripped files).
+    metadata.captureTime = fileTimeFallback(path);
+    return metadata;
+}
+
+void ExifScanner::run(const QStringList &paths, quint64 jobId,
+                      std::shared_ptr<std::atomic_bool> cancelled)
+{
+    std::vector<ExifMetadata> results(size_t(paths.size()));
+    // Workers claim files one at a time so a slow file does not hold up a
+    // whole slice.
+    std::atomic<qsizetype> next { 0 };
+    auto work = [&] {
+        for (qsizetype i = next++; i < paths.size(); i = next++) {
+            if (cancelled->load())
+                return;
+            results[size_t(i)] = read(paths.at(i));
+        }
+    };
+    const int threadCount = qBound(1, QThread::idealThreadCount(), int(qMax<qsizetype>(1, paths.size() / 64)));
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threadCount; ++t)
+        workers.emplace_back(work);
+    work();
+    for (std::thread &w : workers)
+        w.join();
+    if (cancelled->load())
+        return;
+    emit metadataReady(jobId, paths, QList<ExifMetadata>(results.begin(), results.end()));
+}
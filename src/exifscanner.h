@@ -0,0 +1,81 @@
+// exifscanner.h
+//
+// Declares ExifScanner, which reads the shooting metadata behind the
+// metadata filter and the capture-time ordering. Rather than going through
+// QImageReader or LibRaw, it parses only the first few KB of each file: the
+// Exif APP1 segment of a JPEG, the TIFF structure most RAW formats are built
+// on, or the embedded JPEG of a Fujifilm RAF. For the capture time,
+// DateTimeOriginal plus SubSecTimeOriginal are used where present, then the
+// IFD0 DateTime, and finally the file's modification time. Files are
+// scanned in parallel on a set of worker threads.
+
+#pragma once
+
+#include <QList>
+#include <QMetaType>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+// What was found in one file's header. Numeric fields are 0 when the tag
+// is missing; captureTime is always set.
+struct ExifMetadata
+{
+    qint64 captureTime = -1;    // see ExifScanner::captureTime()
+    quint32 iso = 0;
+    float exposure = 0.0f;      // seconds
+    float aperture = 0.0f;      // f-number
+    float focalLength = 0.0f;   // mm
+    quint32 width = 0;
+    quint32 height = 0;
+    QString body;               // "Make Model"
+    QString lens;
+};
+Q_DECLARE_METATYPE(ExifMetadata)
+
+class ExifScanner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ExifScanner(QObject *parent = nullptr);
+    ~ExifScanner() override;
+
+    // Abort any job in progress and start reading metadata for `paths`.
+    // Returns the id carried by the job's result signal.
+    quint64 start(const QStringList &paths);
+
+    // Abort the job in progress, if any, and wait for its threads.
+    void cancel();
+
+    // Capture time of `path` in milliseconds on a local wall-clock scale
+    // (the camera's clock, as if it were UTC), so EXIF times and the
+    // modification-time fallback order consistently. Safe to call from any
+    // thread.
+    static qint64 captureTime(const QString &path) { return read(path).captureTime; }
+
+    // Every field ExifScanner knows about for `path`. Safe to call from any
+    // thread.
+    static ExifMetadata read(const QString &path);
+
+signals:
+    // Emitted from the scan thread once every path has been read;
+    // `metadata` matches `paths` index for index. Not emitted when cancelled.
+    void metadataReady(quint64 jobId, const QStringList &paths, const QList<ExifMetadata> &metadata);
+
+private:
+    void run(const QStringList &paths, quint64 jobId,
+             std::shared_ptr<std::atomic_bool> cancelled);
+
+    // A first short read covers nearly every file; HEADER_BYTES is the most
+    // that is ever read.
+    static constexpr qint64 FIRST_READ_BYTES = 8 * 1024;
+    static constexpr qint64 HEADER_BYTES = 64 * 1024;
+
+    std::thread m_thread;
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+    quint64 m_jobId = 0;
+};
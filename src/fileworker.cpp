@@ -1,87 +1,468 @@
 // fileworker.cpp
 
 #include "fileworker.h"
+#include "movejournal.h"
+#include "nameindex.h"
 
 // For logging move errors.  Qt's debug facilities output messages
 // to the appropriate console or log depending on platform.
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
 
-FileWorker::FileWorker()
-    : m_running(true), m_thread(&FileWorker::run, this)
+#include <algorithm>
+#include <utility>
+
+#ifdef Q_OS_WIN
+#include <QStorageInfo>
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+// Suffixed names tried when a move's destination turns out to be taken.
+constexpr int MAX_NAME_ATTEMPTS = 1000;
+
+#ifndef Q_OS_WIN
+
+// Buffer for the portable read/write copy loop.
+constexpr size_t COPY_BUFFER_BYTES = 1 << 20;
+
+// Rename without ever replacing an existing destination (QFile::rename
+// semantics). Returns 0 or an errno value.
+int renameNoReplace(const QByteArray &source, const QByteArray &destination)
+{
+#ifdef Q_OS_LINUX
+    // RENAME_NOREPLACE makes the check atomic; older kernels and some file
+    // systems reject the flag, in which case the check below is used.
+    constexpr unsigned RENAME_NOREPLACE_FLAG = 1;
+    if (::syscall(SYS_renameat2, AT_FDCWD, source.constData(), AT_FDCWD, destination.constData(),
+                  RENAME_NOREPLACE_FLAG) == 0)
+        return 0;
+    if (errno != EINVAL && errno != ENOSYS)
+        return errno;
+#endif
+    if (::access(destination.constData(), F_OK) == 0)
+        return EEXIST;
+    return ::rename(source.constData(), destination.constData()) == 0 ? 0 : errno;
+}
+
+// Copy `size` bytes from `in` to `out`, both positioned at 0. Returns the
+// number of bytes copied.
+qint64 copyContents(int in, int out, qint64 size)
+{
+    qint64 done = 0;
+#ifdef Q_OS_LINUX
+    // copy_file_range keeps the data in the kernel and lets NFS and SMB
+    // mounts copy server-side; sendfile covers kernels and file system
+    // pairs that refuse it. Either stops at the first error and leaves the
+    // rest to the loop below.
+    while (done < size) {
+        const ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, size_t(size - done), 0);
+        if (n > 0)
+            done += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else
+            break;
+    }
+    while (done < size) {
+        off_t offset = off_t(done);
+        const ssize_t n = ::sendfile(out, in, &offset, size_t(size - done));
+        if (n > 0)
+            done += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else
+            break;
+    }
+#endif
+    if (done >= size)
+        return done;
+    if (::lseek(in, off_t(done), SEEK_SET) < 0 || ::lseek(out, off_t(done), SEEK_SET) < 0)
+        return done;
+    std::vector<char> buffer(COPY_BUFFER_BYTES);
+    while (done < size) {
+        const ssize_t n = ::read(in, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        for (ssize_t written = 0; written < n; ) {
+            const ssize_t w = ::write(out, buffer.data() + written, size_t(n - written));
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return done;
+            written += w;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// Flush the directory entry changes in `directory` (a rename into it) to
+// stable storage. Best effort: not every file system supports it.
+void syncDirectory(const QByteArray &directory)
+{
+    const int fd = ::open(directory.constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    ::fsync(fd);
+    ::close(fd);
+}
+
+// Move across devices: copy into the temporary file `part` next to the
+// destination, flush it to stable storage and check its size, rename it
+// into place, and only then unlink the source. The destination name
+// therefore only ever holds a complete copy. On any failure the copy is
+// removed and the source stays.
+int copyAndUnlink(const QByteArray &source, const QByteArray &destination, const QByteArray &part)
+{
+    const int in = ::open(source.constData(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return errno;
+    struct stat st;
+    if (::fstat(in, &st) != 0) {
+        const int err = errno;
+        ::close(in);
+        return err;
+    }
+    // Left over from a copy cut off by a crash; the name is ours.
+    ::unlink(part.constData());
+    const int out = ::open(part.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+    if (out < 0) {
+        const int err = errno;
+        ::close(in);
+        return err;
+    }
+
+    int err = 0;
+    errno = 0;
+    if (copyContents(in, out, qint64(st.st_size)) != qint64(st.st_size))
+        err = errno ? errno : EIO;
+    // Keep the capture-time fallback (file mtime) intact; journal recovery
+    // also relies on it to recognise the copy.
+#ifdef Q_OS_DARWIN
+    const struct timespec times[2] = { st.st_atimespec, st.st_mtimespec };
+#else
+    const struct timespec times[2] = { st.st_atim, st.st_mtim };
+#endif
+    if (!err)
+        ::futimens(out, times);
+    if (!err && ::fsync(out) != 0)
+        err = errno;
+    struct stat written;
+    if (!err && (::fstat(out, &written) != 0 || written.st_size != st.st_size))
+        err = EIO;
+    if (::close(out) != 0 && !err)
+        err = errno;
+    ::close(in);
+
+    bool placed = false;
+    if (!err) {
+        err = renameNoReplace(part, destination);
+        placed = err == 0;
+    }
+    if (placed) {
+        const qsizetype slash = destination.lastIndexOf('/');
+        syncDirectory(slash > 0 ? destination.left(slash) : QByteArray("/"));
+    }
+    if (!err && ::unlink(source.constData()) != 0)
+        err = errno;
+    if (err)
+        ::unlink(placed ? destination.constData() : part.constData());
+    return err;
+}
+
+#endif
+
+} // namespace
+
+FileWorker::FileWorker(QObject *parent)
+    : QObject(parent)
 {
 }
 
 FileWorker::~FileWorker()
 {
     stop();
-    if (m_thread.joinable()) {
-        m_thread.join();
+    for (const std::shared_ptr<Lane> &lane : std::as_const(m_lanes)) {
+        if (lane->thread.joinable()) {
+            lane->thread.join();
+        }
     }
 }
 
-void FileWorker::enqueue(const FileTask &task)
+QString FileWorker::laneKey(const QString &directory)
+{
+    auto it = m_deviceOfDir.constFind(directory);
+    if (it != m_deviceOfDir.constEnd())
+        return it.value();
+    QString key = directory;
+#ifdef Q_OS_WIN
+    const QStorageInfo storage(directory);
+    if (storage.isValid())
+        key = storage.rootPath();
+#else
+    struct stat st;
+    if (::stat(QFile::encodeName(directory).constData(), &st) == 0)
+        key = QString::number(quint64(st.st_dev));
+#endif
+    m_deviceOfDir.insert(directory, key);
+    return key;
+}
+
+FileWorker::TaskId FileWorker::enqueue(const FileTask &task)
 {
+    // An undo task goes where the move it reverses went.
+    const QString key = laneKey(QFileInfo(task.undo ? task.source : task.destination).absolutePath());
+    std::shared_ptr<Lane> lane;
+    TaskId id = 0;
     {
         std::lock_guard<std::mutex> lock(m_mutex);
-        m_queue.push(task);
+        lane = m_lanes.value(key);
+        if (!lane) {
+            lane = std::make_shared<Lane>();
+            lane->thread = std::thread(&FileWorker::run, this, lane.get());
+            m_lanes.insert(key, lane);
+        }
+        id = ++m_nextId;
+        lane->queue.emplace_back(id, task);
+        FileTask &queued = lane->queue.back().second;
+        takeRenamed(queued);
+        m_pending.insert(id, { lane.get(), std::prev(lane->queue.end()) });
+        m_pendingBySource.insert(queued.source, id);
+        // Announced under the lock so it is queued ahead of Running.
+        emit taskStateChanged(id, int(FileTaskState::Pending), queued.source, queued.destination, QString());
     }
-    m_cv.notify_one();
+    lane->cv.notify_one();
+    return id;
 }
 
-bool FileWorker::cancelTask(const QString &source)
+void FileWorker::unindex(TaskId id, const QString &source)
+{
+    m_pending.remove(id);
+    auto it = m_pendingBySource.find(source);
+    if (it != m_pendingBySource.end() && it.value() == id)
+        m_pendingBySource.erase(it);
+}
+
+bool FileWorker::cancel(TaskId id)
 {
     std::lock_guard<std::mutex> lock(m_mutex);
-    // Temporary queue to hold tasks we keep
-    std::queue<FileTask> temp;
-    bool removed = false;
-    while (!m_queue.empty()) {
-        FileTask t = m_queue.front();
-        m_queue.pop();
-        if (!removed && t.source == source) {
-            // Skip this task
-            removed = true;
-            continue;
-        }
-        temp.push(t);
+    auto it = m_pending.constFind(id);
+    if (it == m_pending.constEnd())
+        return false;
+    const PendingTask pending = it.value();
+    const QString source = pending.position->second.source;
+    pending.lane->queue.erase(pending.position);
+    unindex(id, source);
+    return true;
+}
+
+void FileWorker::takeRenamed(FileTask &task)
+{
+    if (!task.undo || !task.undoes)
+        return;
+    auto renamed = m_renamed.find(task.undoes);
+    if (renamed != m_renamed.end()) {
+        task.source = renamed.value();
+        m_renamed.erase(renamed);
     }
-    m_queue = std::move(temp);
-    return removed;
 }
 
-void FileWorker::stop()
+void FileWorker::acknowledge(TaskId id)
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_renamed.remove(id);
+}
+
+bool FileWorker::cancelTask(const QString &source)
+{
+    TaskId id = 0;
     {
         std::lock_guard<std::mutex> lock(m_mutex);
-        m_running = false;
+        id = m_pendingBySource.value(source, 0);
+    }
+    return id != 0 && cancel(id);
+}
+
+void FileWorker::stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+    for (const std::shared_ptr<Lane> &lane : std::as_const(m_lanes))
+        lane->cv.notify_one();
+}
+
+QString FileWorker::partialCopyPath(const QString &source, const QString &destination)
+{
+    return QFileInfo(destination).dir().filePath(QLatin1Char('.') + QFileInfo(source).fileName()
+                                                 + QStringLiteral(".part"));
+}
+
+bool FileWorker::moveFile(const QString &source, const QString &destination, QString *error,
+                          bool *destinationExists)
+{
+    if (destinationExists)
+        *destinationExists = false;
+#ifdef Q_OS_WIN
+    // MoveFileEx renames within a volume. Across volumes the file is copied
+    // under a temporary name, flushed, and moved into place before the
+    // source is deleted, as copyAndUnlink() does elsewhere. Without
+    // MOVEFILE_REPLACE_EXISTING an existing destination fails.
+    const std::wstring from = QDir::toNativeSeparators(source).toStdWString();
+    const std::wstring to = QDir::toNativeSeparators(destination).toStdWString();
+    if (::MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_WRITE_THROUGH))
+        return true;
+    DWORD err = ::GetLastError();
+    if (err == ERROR_NOT_SAME_DEVICE) {
+        const std::wstring part = QDir::toNativeSeparators(partialCopyPath(source, destination)).toStdWString();
+        ::DeleteFileW(part.c_str());
+        err = ERROR_SUCCESS;
+        bool placed = false;
+        if (!::CopyFileW(from.c_str(), part.c_str(), TRUE)) {
+            err = ::GetLastError();
+        } else {
+            const HANDLE handle = ::CreateFileW(part.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+                                                FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (handle == INVALID_HANDLE_VALUE || !::FlushFileBuffers(handle))
+                err = ::GetLastError();
+            if (handle != INVALID_HANDLE_VALUE)
+                ::CloseHandle(handle);
+            if (err == ERROR_SUCCESS && !::MoveFileExW(part.c_str(), to.c_str(), MOVEFILE_WRITE_THROUGH))
+                err = ::GetLastError();
+            placed = err == ERROR_SUCCESS;
+            if (placed && !::DeleteFileW(from.c_str()))
+                err = ::GetLastError();
+        }
+        if (err == ERROR_SUCCESS)
+            return true;
+        ::DeleteFileW(placed ? to.c_str() : part.c_str());
     }
-    m_cv.notify_one();
+    if (destinationExists)
+        *destinationExists = err == ERROR_ALREADY_EXISTS || err == ERROR_FILE_EXISTS;
+    if (error)
+        *error = qt_error_string(int(err));
+    return false;
+#else
+    const QByteArray from = QFile::encodeName(source);
+    const QByteArray to = QFile::encodeName(destination);
+    int err = renameNoReplace(from, to);
+    // Different file systems (a card and a NAS mount): fall back to a copy.
+    if (err == EXDEV)
+        err = copyAndUnlink(from, to, QFile::encodeName(partialCopyPath(source, destination)));
+    if (destinationExists)
+        *destinationExists = err == EEXIST;
+    if (err && error)
+        *error = qt_error_string(err);
+    return err == 0;
+#endif
 }
 
-void FileWorker::run()
+void FileWorker::run(Lane *lane)
 {
     while (true) {
+        TaskId id = 0;
         FileTask task;
         {
             std::unique_lock<std::mutex> lock(m_mutex);
-            m_cv.wait(lock, [this]{ return !m_running || !m_queue.empty(); });
-            if (!m_running && m_queue.empty()) {
+            lane->cv.wait(lock, [this, lane]{ return !m_running || !lane->queue.empty(); });
+            // Pending moves are still carried out after stop().
+            if (lane->queue.empty()) {
                 break;
             }
-            if (!m_queue.empty()) {
-                task = m_queue.front();
-                m_queue.pop();
-            }
+            id = lane->queue.front().first;
+            task = std::move(lane->queue.front().second);
+            lane->queue.pop_front();
+            unindex(id, task.source);
+            emit taskStateChanged(id, int(FileTaskState::Running), task.source, task.destination, QString());
+        }
+        // Write-ahead: the decision is on disk before the file moves.  An
+        // undo also waits for the outcome of the move it reverses, which may
+        // have been logged after the undo was, so recovery never sees an
+        // undo under way for a move that is not recorded as done.
+        if (m_journal && task.journalId) {
+            m_journal->waitDurable(task.undo ? m_journal->lastSequence() : task.journalSequence);
         }
-        if (!task.source.isEmpty() && !task.destination.isEmpty()) {
-            // Perform the file move. QFile::rename returns true on success.
-            // If the rename fails (e.g. due to permissions or files on different
-            // volumes), log a warning so the caller can investigate. Consider
-            // adding more robust error handling in the future (copy/delete on
-            // failure).
-            if (!QFile::rename(task.source, task.destination)) {
-                qWarning() << "FileWorker: failed to move" << task.source
-                           << "to" << task.destination;
+        QString error;
+        bool exists = false;
+        bool ok = !task.source.isEmpty() && !task.destination.isEmpty()
+                  && moveFile(task.source, task.destination, &error, &exists);
+        if (!ok && task.undo && !QFileInfo::exists(task.source) && QFileInfo::exists(task.destination)) {
+            // The move being undone never happened; the file is in place.
+            ok = true;
+            error.clear();
+        }
+        // The name was taken behind the window's name index (by another
+        // program, or before the folder listing arrived): try the next
+        // suffixed name in the same folder rather than fail the move.
+        if (!ok && exists && !task.undo) {
+            const QDir dir = QFileInfo(task.destination).dir();
+            const QString fileName = QFileInfo(task.source).fileName();
+            for (int counter = 1; !ok && exists && counter <= MAX_NAME_ATTEMPTS; ++counter) {
+                const QString candidate = dir.filePath(NameIndex::suffixed(fileName, counter));
+                if (QFileInfo::exists(candidate))
+                    continue;
+                // Journaled before the file can land there, so recovery
+                // knows where to look for it.
+                if (m_journal && task.journalId) {
+                    MoveJournal::Record renamed;
+                    renamed.type = MoveJournal::Renamed;
+                    renamed.moveId = task.journalId;
+                    renamed.destination = candidate;
+                    m_journal->waitDurable(m_journal->append(renamed));
+                }
+                ok = moveFile(task.source, candidate, &error, &exists);
+                if (ok)
+                    task.destination = candidate;
+            }
+            if (ok) {
+                // An undo queued behind the move is pointed at the new name
+                // now; one enqueued before the window hears of it picks the
+                // name up from m_renamed.
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto undo = std::find_if(lane->queue.begin(), lane->queue.end(), [id](const auto &queued) {
+                    return queued.second.undo && queued.second.undoes == id;
+                });
+                if (undo != lane->queue.end()) {
+                    unindex(undo->first, undo->second.source);
+                    undo->second.source = task.destination;
+                    m_pending.insert(undo->first, { lane, undo });
+                    m_pendingBySource.insert(undo->second.source, undo->first);
+                } else {
+                    m_renamed.insert(id, task.destination);
+                }
             }
         }
+        if (!ok) {
+            qWarning() << "FileWorker: failed to move" << task.source
+                       << "to" << task.destination << ":" << error;
+        }
+        if (m_journal && task.journalId) {
+            MoveJournal::Record outcome;
+            if (task.undo)
+                outcome.type = ok ? MoveJournal::UndoDone : MoveJournal::UndoFailed;
+            else
+                outcome.type = ok ? MoveJournal::MoveDone : MoveJournal::MoveFailed;
+            outcome.moveId = task.journalId;
+            if (ok && !task.undo)
+                outcome.destination = task.destination;     // the name actually used
+            m_journal->append(outcome);
+        }
+        emit taskStateChanged(id, int(ok ? FileTaskState::Done : FileTaskState::Failed),
+                              task.source, task.destination, error);
     }
 }
@@ -1,52 +1,155 @@
 // fileworker.h
 //
-// Defines a simple background worker that processes file move tasks on a
-// separate thread. Utilizes a thread‑safe queue guarded by a mutex and
-// condition variable. The worker continually waits for tasks to be
-// available and performs file operations without blocking the UI.
+// Defines a background worker that processes file move tasks off the GUI
+// thread. Tasks are routed to one lane per destination device, each with
+// its own thread and queue guarded by a shared mutex, so a slow target
+// (a NAS mount) never holds up moves to a fast one (the local disk). A move
+// is a plain rename where possible; when source and destination are on
+// different volumes the file is copied in the kernel under a temporary
+// name, synced, verified, renamed into place and only then removed from
+// the source. Every task gets a handle, its state
+// changes are reported back through a signal, and a pending task can be
+// cancelled in constant time by handle or by source path.
 
 #pragma once
 
+#include <QHash>
+#include <QObject>
 #include <QString>
-#include <QFile>
 
-#include <queue>
+#include <condition_variable>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <thread>
-#include <condition_variable>
+#include <utility>
+
+class MoveJournal;
 
 // A task describing a file move operation: move `source` to `destination`.
+// A task with a journal id waits until its journal record at
+// `journalSequence` is durable and then logs its outcome.
+//
+// An undo task moves the file of an earlier task `undoes` back: `source`
+// is that task's destination. It runs on the same lane, so it is carried
+// out after the earlier move whatever state that was in, follows the file
+// if the earlier move had to pick another name, and is never renamed
+// itself. If the file never left `destination` (the earlier move failed)
+// it reports Done without doing anything.
 struct FileTask
 {
     QString source;
     QString destination;
+    quint64 journalId = 0;
+    quint64 journalSequence = 0;
+    bool undo = false;
+    quint64 undoes = 0;
 };
 
-class FileWorker
+// Lifecycle of a queued task, as reported by FileWorker::taskStateChanged.
+enum class FileTaskState
 {
+    Pending,    // queued, can still be cancelled
+    Running,    // being moved; too late to cancel
+    Done,
+    Failed      // nothing was moved; the source is still in place
+};
+
+class FileWorker : public QObject
+{
+    Q_OBJECT
 public:
-    FileWorker();
-    ~FileWorker();
+    // Handle of an enqueued task. Never 0.
+    using TaskId = quint64;
+
+    explicit FileWorker(QObject *parent = nullptr);
+    ~FileWorker() override;
 
-    // Enqueue a new move task.  The worker will process it asynchronously.
-    void enqueue(const FileTask &task);
+    // Enqueue a new move task on the lane for the destination's device (the
+    // source's, for an undo task). The worker will process it
+    // asynchronously.
+    TaskId enqueue(const FileTask &task);
 
-    // Attempt to cancel a pending task with the given source path.  If a
-    // matching task is found and removed from the queue, return true.
-    // If the task is not in the queue (either already processed or not
-    // present), return false. This is used by undo logic to remove
-    // tasks that have not yet executed.
+    // Remove a pending task from its queue. Returns false if it has already
+    // started (or finished, or never existed); undo then has to wait for
+    // the task's outcome instead. O(1).
+    bool cancel(TaskId id);
+    // Same, for the pending task moving `source`. O(1).
     bool cancelTask(const QString &source);
+    // The Done of task `id` has been handled: undo tasks enqueued from now
+    // on name the file where that Done said it ended up. Until then the
+    // worker remembers the free name a move had to pick, for an undo
+    // enqueued meanwhile that still names the requested one.
+    void acknowledge(TaskId id);
 
-    // Stop the worker thread gracefully.  Called during shutdown.
+    // Journal that moves are logged to. Must outlive the worker; set before
+    // the first enqueue().
+    void setJournal(MoveJournal *journal) { m_journal = journal; }
+
+    // Stop the worker threads gracefully once their queues are drained.
+    // Called during shutdown.
     void stop();
 
+    // Move `source` to `destination` on the calling thread: a rename, or a
+    // copy plus verified unlink across devices. Never overwrites an
+    // existing destination. Returns false and leaves the source in place on
+    // failure, with a reason in `error` if given; `destinationExists` is set
+    // when that is why it failed.
+    static bool moveFile(const QString &source, const QString &destination, QString *error = nullptr,
+                         bool *destinationExists = nullptr);
+
+    // The temporary file moveFile() copies `source` into, next to
+    // `destination`, when the two are on different devices. It exists only
+    // while a copy is under way, or after one was cut off by a crash.
+    static QString partialCopyPath(const QString &source, const QString &destination);
+
+signals:
+    // Emitted with Pending from enqueue() and with the later states from a
+    // lane thread; connect with Qt::QueuedConnection. `state` is a
+    // FileTaskState and `error` is only set for Failed. For Done,
+    // `destination` is where the file ended up: if the requested name was
+    // taken by then, the worker picked the next free "name_N.ext".
+    void taskStateChanged(quint64 taskId, int state, const QString &source,
+                          const QString &destination, const QString &error);
+
 private:
-    void run();
+    using Queue = std::list<std::pair<TaskId, FileTask>>;
+
+    struct Lane
+    {
+        Queue queue;
+        std::condition_variable cv;
+        std::thread thread;
+    };
+
+    // Where a pending task sits, so it can be unlinked without a search.
+    struct PendingTask
+    {
+        Lane *lane = nullptr;
+        Queue::iterator position;
+    };
+
+    void run(Lane *lane);
+    // Drop the index entries of a task leaving its queue. Needs m_mutex.
+    void unindex(TaskId id, const QString &source);
+    // Point an undo task being enqueued at the free name the move it
+    // reverses picked, if any, and forget that name. Needs m_mutex.
+    void takeRenamed(FileTask &task);
+
+    // Identifies the device holding `directory`; tasks with the same key
+    // share a lane. Looked up once per destination directory.
+    QString laneKey(const QString &directory);
 
-    std::queue<FileTask> m_queue;
+    MoveJournal *m_journal = nullptr;
     std::mutex m_mutex;
-    std::condition_variable m_cv;
-    bool m_running;
-    std::thread m_thread;
+    bool m_running = true;
+    QHash<QString, QString> m_deviceOfDir;
+    QHash<QString, std::shared_ptr<Lane>> m_lanes;
+    QHash<TaskId, PendingTask> m_pending;
+    QHash<QString, TaskId> m_pendingBySource;
+    // Where moves that had to pick a free name ended up, for an undo task
+    // enqueued after they finished but before the window handled their
+    // Done. Cleared by that undo or by acknowledge().
+    QHash<TaskId, QString> m_renamed;
+    TaskId m_nextId = 0;
 };
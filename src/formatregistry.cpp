@@ -0,0 +1,202 @@
+// formatregistry.cpp
+
+#include "formatregistry.h"
+
+#include <QFile>
+#include <QHash>
+#include <QStringList>
+
+#include <atomic>
+#include <cstring>
+
+namespace {
+
+using FormatRegistry::Format;
+
+struct FormatEntry
+{
+    Format format;
+    const char *name;
+    const char *qtFormat;   // nullptr: let QImageReader detect it
+    bool raw;
+};
+
+// Indexed by Format.
+const FormatEntry FORMATS[] = {
+    { Format::Unknown, "unknown", nullptr, false },
+    { Format::Jpeg, "JPEG", "jpeg", false },
+    { Format::Png, "PNG", "png", false },
+    { Format::Gif, "GIF", "gif", false },
+    { Format::Bmp, "BMP", "bmp", false },
+    { Format::WebP, "WebP", "webp", false },
+    { Format::Avif, "AVIF", "avif", false },
+    { Format::Tiff, "TIFF", "tiff", false },
+    { Format::TiffRaw, "TIFF RAW", nullptr, true },
+    { Format::Cr3, "CR3", nullptr, true },
+    { Format::Raf, "RAF", nullptr, true },
+    { Format::OtherRaw, "RAW", nullptr, true },
+};
+static_assert(sizeof(FORMATS) / sizeof(FORMATS[0]) == size_t(Format::Count), "one entry per format");
+
+struct SuffixEntry
+{
+    const char *suffix;
+    Format format;
+};
+
+// Every extension the browser lists. RAW extensions name the container
+// they normally hold; sniff() has the final word.
+const SuffixEntry SUFFIXES[] = {
+    { "jpg", Format::Jpeg }, { "jpeg", Format::Jpeg }, { "png", Format::Png },
+    { "bmp", Format::Bmp }, { "gif", Format::Gif }, { "tif", Format::Tiff },
+    { "tiff", Format::Tiff }, { "webp", Format::WebP }, { "avif", Format::Avif },
+    { "arw", Format::TiffRaw }, { "cr2", Format::TiffRaw }, { "dng", Format::TiffRaw },
+    { "nef", Format::TiffRaw }, { "nrw", Format::TiffRaw }, { "pef", Format::TiffRaw },
+    { "srw", Format::TiffRaw }, { "cr3", Format::Cr3 }, { "raf", Format::Raf },
+    { "orf", Format::OtherRaw }, { "rw2", Format::OtherRaw }, { "rwl", Format::OtherRaw },
+    { "raw", Format::OtherRaw },
+};
+
+const QHash<QString, Format> &suffixTable()
+{
+    static const QHash<QString, Format> table = [] {
+        QHash<QString, Format> t;
+        for (const SuffixEntry &entry : SUFFIXES)
+            t.insert(QString::fromLatin1(entry.suffix), entry.format);
+        return t;
+    }();
+    return table;
+}
+
+struct Counters
+{
+    std::atomic<quint64> decodes{ 0 };
+    std::atomic<quint64> failures{ 0 };
+    std::atomic<qint64> totalNs{ 0 };
+    std::atomic<qint64> maxNs{ 0 };
+};
+
+Counters COUNTERS[size_t(Format::Count)];
+
+// True if `data` holds `magic` (a string literal, which may contain NULs)
+// at `offset`.
+template<size_t N>
+bool startsWith(const QByteArray &data, int offset, const char (&magic)[N])
+{
+    constexpr int length = int(N) - 1;
+    return data.size() >= offset + length && std::memcmp(data.constData() + offset, magic, size_t(length)) == 0;
+}
+
+} // namespace
+
+FormatRegistry::Format FormatRegistry::formatForSuffix(const QString &path)
+{
+    // Called for every file a scan finds, so no QFileInfo.
+    const qsizetype dot = path.lastIndexOf(QLatin1Char('.'));
+    if (dot < 0)
+        return Format::Unknown;
+    return suffixTable().value(path.mid(dot + 1).toLower(), Format::Unknown);
+}
+
+bool FormatRegistry::isRawFormat(Format format)
+{
+    return FORMATS[size_t(format)].raw;
+}
+
+FormatRegistry::Format FormatRegistry::sniff(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return formatForSuffix(path);
+    return sniff(file.read(HEADER_BYTES), path);
+}
+
+FormatRegistry::Format FormatRegistry::sniff(const QByteArray &header, const QString &path)
+{
+    const Format bySuffix = formatForSuffix(path);
+    if (startsWith(header, 0, "\xFF\xD8\xFF"))
+        return Format::Jpeg;
+    if (startsWith(header, 0, "\x89PNG"))
+        return Format::Png;
+    if (startsWith(header, 0, "GIF8"))
+        return Format::Gif;
+    if (startsWith(header, 0, "BM"))
+        return Format::Bmp;
+    if (startsWith(header, 0, "RIFF") && startsWith(header, 8, "WEBP"))
+        return Format::WebP;
+    if (startsWith(header, 4, "ftyp")) {
+        if (startsWith(header, 8, "avif") || startsWith(header, 8, "avis"))
+            return Format::Avif;
+        if (startsWith(header, 8, "crx "))
+            return Format::Cr3;
+    }
+    if (startsWith(header, 0, "FUJIFILMCCD-RAW"))
+        return Format::Raf;
+    if (startsWith(header, 0, "II*\x00") || startsWith(header, 0, "MM\x00*"))
+        return isRawFormat(bySuffix) ? Format::TiffRaw : Format::Tiff;
+    // Olympus ("IIRO", "IIRS", "MMOR") and Panasonic ("IIU\0") use TIFF
+    // layouts with their own magic.
+    if (startsWith(header, 0, "IIRO") || startsWith(header, 0, "IIRS") || startsWith(header, 0, "MMOR")
+        || startsWith(header, 0, "IIU\x00"))
+        return Format::OtherRaw;
+    // Not recognised: trust the extension, and let the decoder sort it out.
+    return bySuffix;
+}
+
+FormatRegistry::Decoder FormatRegistry::decoderFor(Format format)
+{
+    return isRawFormat(format) ? Decoder::Raw : Decoder::Qt;
+}
+
+QByteArray FormatRegistry::qtFormat(Format format)
+{
+    const char *qt = FORMATS[size_t(format)].qtFormat;
+    return qt ? QByteArray(qt) : QByteArray();
+}
+
+const char *FormatRegistry::name(Format format)
+{
+    return FORMATS[size_t(format)].name;
+}
+
+void FormatRegistry::recordDecode(Format format, qint64 nanoseconds, bool ok)
+{
+    Counters &c = COUNTERS[size_t(format)];
+    c.decodes.fetch_add(1, std::memory_order_relaxed);
+    if (!ok)
+        c.failures.fetch_add(1, std::memory_order_relaxed);
+    c.totalNs.fetch_add(nanoseconds, std::memory_order_relaxed);
+    qint64 worst = c.maxNs.load(std::memory_order_relaxed);
+    while (nanoseconds > worst && !c.maxNs.compare_exchange_weak(worst, nanoseconds, std::memory_order_relaxed)) {
+    }
+}
+
+FormatRegistry::Stats FormatRegistry::stats(Format format)
+{
+    const Counters &c = COUNTERS[size_t(format)];
+    Stats s;
+    s.decodes = c.decodes.load(std::memory_order_relaxed);
+    s.failures = c.failures.load(std::memory_order_relaxed);
+    s.totalNs = c.totalNs.load(std::memory_order_relaxed);
+    s.maxNs = c.maxNs.load(std::memory_order_relaxed);
+    return s;
+}
+
+QString FormatRegistry::summary()
+{
+    QStringList lines;
+    for (int i = 0; i < int(Format::Count); ++i) {
+        const Stats s = stats(Format(i));
+        if (s.decodes == 0)
+            continue;
+        QString line = QStringLiteral("%1: %2 × %3 ms (max %4 ms)")
+                           .arg(QLatin1String(name(Format(i))))
+                           .arg(s.decodes)
+                           .arg(double(s.totalNs) / double(s.decodes) / 1e6, 0, 'f', 1)
+                           .arg(double(s.maxNs) / 1e6, 0, 'f', 1);
+        if (s.failures)
+            line += QStringLiteral(", %1 failed").arg(s.failures);
+        lines.append(line);
+    }
+    return lines.join(QLatin1Char('\n'));
+}
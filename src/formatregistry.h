@@ -0,0 +1,73 @@
+// formatregistry.h
+//
+// Declares FormatRegistry, the single table of image formats the browser
+// knows about. It maps file extensions to formats (which decides what a
+// folder scan lists), identifies a file's actual format from its first
+// bytes, and names the decoder that handles it, so ImageLoader reads the
+// header once and goes straight to the right decoder: Qt's reader with its
+// format fixed for raster files, LibRaw for RAW files. The registry also
+// keeps per-format decode counters (count, failures, time), which are
+// updated from the decode threads and shown in the cache status tooltip.
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+namespace FormatRegistry {
+    enum class Format
+    {
+        Unknown,
+        Jpeg,
+        Png,
+        Gif,
+        Bmp,
+        WebP,
+        Avif,
+        Tiff,
+        TiffRaw,    // TIFF container with a RAW extension: DNG, NEF, ARW, CR2, PEF, ...
+        Cr3,
+        Raf,
+        OtherRaw,   // ORF, RW2 and RAW containers recognised by extension only
+        Count
+    };
+
+    enum class Decoder
+    {
+        Qt,         // QImageReader
+        Raw         // LibRaw (embedded preview, then demosaic)
+    };
+
+    // Bytes sniff() looks at.
+    constexpr int HEADER_BYTES = 16;
+
+    // Format implied by the file name's extension (any case), Unknown if
+    // the browser does not list such files.
+    Format formatForSuffix(const QString &path);
+    bool isRawFormat(Format format);
+
+    // Identify a file from its first HEADER_BYTES bytes. The extension only
+    // breaks the tie between a plain TIFF and a TIFF-based RAW; a RAW name
+    // on a file that is really a JPEG gets the JPEG decoder.
+    Format sniff(const QString &path);
+    Format sniff(const QByteArray &header, const QString &path);
+
+    Decoder decoderFor(Format format);
+    // Format name for QImageReader::setFormat(), empty if Qt has to
+    // detect it.
+    QByteArray qtFormat(Format format);
+    const char *name(Format format);
+
+    // Decode timing, per format. Thread-safe.
+    struct Stats
+    {
+        quint64 decodes = 0;
+        quint64 failures = 0;
+        qint64 totalNs = 0;
+        qint64 maxNs = 0;
+    };
+    void recordDecode(Format format, qint64 nanoseconds, bool ok);
+    Stats stats(Format format);
+    // One line per format decoded so far: count, mean and worst time.
+    QString summary();
+}
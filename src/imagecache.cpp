@@ -0,0 +1,107 @@
+// imagecache.cpp
+
+#include "imagecache.h"
+
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+ImageCache::ImageCache(qint64 budgetBytes)
+    : m_budget(budgetBytes)
+{
+}
+
+void ImageCache::setBudget(qint64 bytes)
+{
+    m_budget = bytes;
+    trim();
+}
+
+QImage ImageCache::find(const QString &key)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        ++m_misses;
+        return QImage();
+    }
+    ++m_hits;
+    it->lastUse = ++m_clock;
+    return it->image;
+}
+
+void ImageCache::insert(const QString &key, const QImage &image)
+{
+    if (image.isNull())
+        return;
+    remove(key);
+    Entry e;
+    e.image = image;
+    e.bytes = image.sizeInBytes();
+    e.lastUse = ++m_clock;
+    m_entries.insert(key, e);
+    m_resident += e.bytes;
+    m_insertedBytes += e.bytes;
+    ++m_insertedCount;
+    trim();
+}
+
+void ImageCache::remove(const QString &key)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+        return;
+    m_resident -= it->bytes;
+    m_entries.erase(it);
+}
+
+void ImageCache::clear()
+{
+    m_entries.clear();
+    m_resident = 0;
+}
+
+void ImageCache::trim()
+{
+    if (m_resident <= m_budget || m_entries.isEmpty())
+        return;
+
+    // Rank every entry once: unwanted entries first, then furthest from the
+    // cursor, then least recently used. The protected entry (rank 0) is kept
+    // even if it alone exceeds the budget.
+    struct Candidate { int distance; quint64 lastUse; QString key; };
+    std::vector<Candidate> candidates;
+    candidates.reserve(m_entries.size());
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        const int distance = m_distance ? m_distance(it.key()) : 1;
+        if (distance == 0)
+            continue;
+        candidates.push_back({ distance < 0 ? INT_MAX : distance, it->lastUse, it.key() });
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        if (a.distance != b.distance)
+            return a.distance > b.distance;
+        return a.lastUse < b.lastUse;
+    });
+    for (const Candidate &c : candidates) {
+        if (m_resident <= m_budget)
+            break;
+        remove(c.key);
+    }
+}
+
+qint64 ImageCache::sizeOf(const QString &key) const
+{
+    auto it = m_entries.constFind(key);
+    return it == m_entries.constEnd() ? -1 : it->bytes;
+}
+
+qint64 ImageCache::averageImageBytes() const
+{
+    return m_insertedCount ? m_insertedBytes / qint64(m_insertedCount) : 0;
+}
+
+double ImageCache::hitRate() const
+{
+    const quint64 total = m_hits + m_misses;
+    return total ? double(m_hits) / double(total) : 0.0;
+}
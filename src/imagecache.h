@@ -0,0 +1,84 @@
+// imagecache.h
+//
+// Declares ImageCache, the byte-budgeted store of decoded images used for
+// preloading. Entries are keyed by absolute path. When the resident size
+// exceeds the budget, entries are evicted by distance from the cursor
+// (furthest first, as reported by a caller-supplied function) and then by
+// least recent use. The cache also keeps hit/miss counters for reporting.
+// It is not thread-safe and is meant to be used from the GUI thread.
+
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <QString>
+
+#include <functional>
+
+class ImageCache
+{
+public:
+    // Returns the eviction rank of a key: larger values are evicted first,
+    // 0 marks an entry that must never be evicted and negative values mark
+    // entries that are no longer wanted at all.
+    using DistanceFn = std::function<int(const QString &)>;
+
+    explicit ImageCache(qint64 budgetBytes = 0);
+
+    void setBudget(qint64 bytes);
+    qint64 budget() const { return m_budget; }
+
+    void setDistanceFunction(DistanceFn fn) { m_distance = std::move(fn); }
+
+    // Presence test that neither touches the LRU order nor the statistics.
+    bool contains(const QString &key) const { return m_entries.contains(key); }
+
+    // Size in bytes of a resident entry, or -1 if the key is not cached.
+    qint64 sizeOf(const QString &key) const;
+
+    // Return the cached image (null if absent), counting a hit or a miss and
+    // marking the entry as most recently used.
+    QImage find(const QString &key);
+
+    // Return the cached image (null if absent) without recording a lookup.
+    QImage peek(const QString &key) const { return m_entries.value(key).image; }
+
+    // Insert or replace an entry, then trim back under the budget.
+    void insert(const QString &key, const QImage &image);
+    void remove(const QString &key);
+    void clear();
+
+    // Evict entries until the resident size fits the budget. Called
+    // automatically on insert; call it after the cursor moves or the budget
+    // shrinks.
+    void trim();
+
+    qint64 residentBytes() const { return m_resident; }
+    int count() const { return m_entries.size(); }
+
+    // Mean size of the images inserted so far, used to estimate how many
+    // not-yet-decoded images fit into the budget. 0 until the first insert.
+    qint64 averageImageBytes() const;
+
+    quint64 hits() const { return m_hits; }
+    quint64 misses() const { return m_misses; }
+    double hitRate() const;
+
+private:
+    struct Entry
+    {
+        QImage image;
+        qint64 bytes = 0;
+        quint64 lastUse = 0;
+    };
+
+    QHash<QString, Entry> m_entries;
+    DistanceFn m_distance;
+    qint64 m_budget = 0;
+    qint64 m_resident = 0;
+    quint64 m_clock = 0;
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+    qint64 m_insertedBytes = 0;
+    quint64 m_insertedCount = 0;
+};
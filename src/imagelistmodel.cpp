@@ -0,0 +1,60 @@
+// imagelistmodel.cpp
+
+#include "imagelistmodel.h"
+
+#include <QFileIconProvider>
+
+ImageListModel::ImageListModel(const std::vector<QFileInfo> &images,
+                               const QHash<QString, QPixmap> &thumbnails,
+                               QObject *parent)
+    : QAbstractListModel(parent),
+    m_images(images),
+    m_thumbnails(thumbnails)
+{
+    // One generic file icon shared by every row still waiting for its
+    // thumbnail, rather than a per-file QFileIconProvider lookup.
+    QFileIconProvider iconProvider;
+    m_placeholder = iconProvider.icon(QFileIconProvider::File);
+}
+
+int ImageListModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return static_cast<int>(m_images.size());
+}
+
+QVariant ImageListModel::data(const QModelIndex &index, int role) const
+{
+    const int row = index.row();
+    if (!index.isValid() || row < 0 || row >= static_cast<int>(m_images.size()))
+        return QVariant();
+
+    const QFileInfo &fi = m_images[row];
+    switch (role) {
+    case Qt::DisplayRole:
+        return fi.fileName();
+    case Qt::ToolTipRole:
+        return fi.absoluteFilePath();
+    case Qt::DecorationRole: {
+        // Views only ask for the rows they paint, so this is where thumbnail
+        // loading is driven from.
+        auto it = m_thumbnails.constFind(fi.absoluteFilePath());
+        if (it != m_thumbnails.constEnd())
+            return *it;
+        if (m_requester)
+            m_requester(row);
+        return m_placeholder;
+    }
+    default:
+        return QVariant();
+    }
+}
+
+void ImageListModel::thumbnailChanged(int row)
+{
+    if (row < 0 || row >= static_cast<int>(m_images.size()))
+        return;
+    const QModelIndex idx = index(row);
+    emit dataChanged(idx, idx, { Qt::DecorationRole });
+}
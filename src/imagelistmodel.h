@@ -0,0 +1,56 @@
+// imagelistmodel.h
+//
+// Declares ImageListModel, the model behind the side file browser. It reads
+// directly from the window's image vector and thumbnail cache instead of
+// materialising one item per file, so a view only ever touches the rows it
+// is showing. Structural changes to the vector are announced through the
+// begin/end helpers, which map onto Qt's row insertion/removal signals.
+
+#pragma once
+
+#include <QAbstractListModel>
+#include <QFileInfo>
+#include <QHash>
+#include <QIcon>
+#include <QPixmap>
+
+#include <functional>
+#include <vector>
+
+class ImageListModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    // Called from data() when a visible row has no cached thumbnail. The
+    // callback must not modify the model synchronously.
+    using ThumbnailRequester = std::function<void(int row)>;
+
+    ImageListModel(const std::vector<QFileInfo> &images,
+                   const QHash<QString, QPixmap> &thumbnails,
+                   QObject *parent = nullptr);
+
+    void setThumbnailRequester(ThumbnailRequester requester) { m_requester = std::move(requester); }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    // Bracket a change to the backing vector. Each begin must be paired with
+    // the matching end once the vector has been updated.
+    void beginInsertImage(int row) { beginInsertRows(QModelIndex(), row, row); }
+    void endInsertImage() { endInsertRows(); }
+    void beginInsertImages(int first, int last) { beginInsertRows(QModelIndex(), first, last); }
+    void endInsertImages() { endInsertRows(); }
+    void beginRemoveImage(int row) { beginRemoveRows(QModelIndex(), row, row); }
+    void endRemoveImage() { endRemoveRows(); }
+    void beginResetImages() { beginResetModel(); }
+    void endResetImages() { endResetModel(); }
+
+    // Tell views that the thumbnail for `row` became available.
+    void thumbnailChanged(int row);
+
+private:
+    const std::vector<QFileInfo> &m_images;
+    const QHash<QString, QPixmap> &m_thumbnails;
+    ThumbnailRequester m_requester;
+    QIcon m_placeholder;
+};
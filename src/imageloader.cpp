@@ -2,122 +2,134 @@
 
 #include "imageloader.h"
 #include <QImageReader>
-#include <QColor>
-#include <QFileInfo>
-#include <QSet>
+#include <QImageIOHandler>
+#include <QElapsedTimer>
+
+#include "formatregistry.h"
+#include "tiffpreview.h"
 
 // Optional raw support: Only include and use RawLoader when LibRaw is available.
 #ifdef HAVE_LIBRAW
 #include "rawloader.h"
 #endif
 
-ImageLoader::ImageLoader(int index,
-                         const QString &path,
-                         QObject *parent,
-                         QSize targetSize)
-    : QThread(parent),
-    m_index(index),
-    m_path(path),
-    m_targetSize(targetSize)
+// Scale `image` to fit `targetSize` (preserving aspect ratio) unless it
+// already does to within rounding. Runs on the worker so the GUI thread can
+// blit the result directly.
+static QImage fitTo(const QImage &image, QSize targetSize)
 {
-    // nothing else
-    }
+    if (image.isNull() || !targetSize.isValid() || targetSize.isEmpty())
+        return image;
+    const QSize fitted = image.size().scaled(targetSize, Qt::KeepAspectRatio);
+    if (qAbs(fitted.width() - image.width()) <= 1 && qAbs(fitted.height() - image.height()) <= 1)
+        return image;
+    return image.scaled(fitted, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+}
 
-ImageLoader::~ImageLoader()
+bool ImageLoader::isRawFile(const QString &path)
 {
-    // Ensure the thread is stopped before destruction
-    requestInterruption();
-    quit();
-    wait();
+    return FormatRegistry::isRawFormat(FormatRegistry::formatForSuffix(path));
 }
 
-void ImageLoader::run()
+bool ImageLoader::isImageFile(const QString &path)
 {
-    if (isInterruptionRequested())
-        return;
-
-    // Attempt to load the file in several ways. First try using
-    // Qt's image reader (covers JPEG/PNG/etc.). If that fails and the
-    // file has a RAW extension we fall back to LibRaw via RawLoader
-    // (when available). If all attempts fail, emit a simple placeholder.
-    QImage image;
-
-    // Check for RAW file extension up front. Comparison uses lower-case
-    // suffixes; any extension present in the set below will be considered
-    // a RAW format handled by LibRaw.
-    auto isRawExtension = [](const QString &ext) {
-        static const QSet<QString> rawExts = {
-            QStringLiteral("arw"), QStringLiteral("cr2"), QStringLiteral("cr3"),
-            QStringLiteral("nef"), QStringLiteral("nrw"), QStringLiteral("raf"),
-            QStringLiteral("rw2"), QStringLiteral("rwl"), QStringLiteral("orf"),
-            QStringLiteral("pef"), QStringLiteral("srw"), QStringLiteral("dng"),
-            QStringLiteral("raw")
-        };
-        return rawExts.contains(ext.toLower());
-    };
-
-    const QString ext = QFileInfo(m_path).suffix();
-    const bool isRaw = isRawExtension(ext);
-
-    // 1) Try QImageReader (supports scaling and EXIF transforms).
-    {
-        QImageReader reader(m_path);
-        reader.setAutoTransform(true); // honor EXIF orientation, etc.
-
-        if (m_targetSize.isValid() && m_targetSize.width() > 0 && m_targetSize.height() > 0) {
-            reader.setScaledSize(m_targetSize);
-        }
-
-        if (!isInterruptionRequested() && reader.read(&image) && !image.isNull()) {
-            emit this->loaded(m_index, m_path, image);
-            return;
-        }
-    }
+    return FormatRegistry::formatForSuffix(path) != FormatRegistry::Format::Unknown;
+}
 
-    // 2) Try direct QImage::load() as a last quick attempt for non-RAW formats.
-    if (!isInterruptionRequested() && !isRaw) {
-        QImage fallback(m_path);
-        if (!fallback.isNull()) {
-            if (m_targetSize.isValid() && m_targetSize.width() > 0 && m_targetSize.height() > 0) {
-                fallback = fallback.scaled(m_targetSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            }
-            emit this->loaded(m_index, m_path, fallback);
-            return;
+// Decode through QImageReader, straight to the fitted size where the format
+// supports it. A non-empty `format` skips Qt's own content detection.
+static QImage readWithQt(const QString &path, const QByteArray &format, QSize targetSize)
+{
+    QImageReader reader(path, format);
+    reader.setAutoTransform(true); // honor EXIF orientation, etc.
+
+    // Decode straight to the fitted size where the format supports it
+    // (JPEG uses scaled IDCT, so far less work than a full decode). The
+    // header size is pre-orientation, so swap the bounds for images the
+    // EXIF transform will rotate by 90 degrees.
+    if (targetSize.isValid() && !targetSize.isEmpty()) {
+        const QSize source = reader.size();
+        if (source.isValid() && !source.isEmpty()) {
+            const bool rotated = reader.transformation() & QImageIOHandler::TransformationRotate90;
+            reader.setScaledSize(source.scaled(rotated ? targetSize.transposed() : targetSize,
+                                               Qt::KeepAspectRatio));
         }
     }
+    QImage image;
+    if (!reader.read(&image))
+        return QImage();
+    return fitTo(image, targetSize);
+}
 
+// Decode a RAW file through LibRaw: the embedded preview (usually a JPEG,
+// fast and plenty for the screen), else a half-size demosaic.
+static QImage readWithLibRaw(const QString &path, QSize targetSize, const std::atomic_bool *cancel)
+{
 #ifdef HAVE_LIBRAW
-    // 3) RAW fallback via LibRaw (fast embedded preview first, then half-size demosaic).
-    if (!isInterruptionRequested()) {
-        QImage rawImage;
-        bool rawLoaded = false; // avoid shadowing the 'loaded' signal
-
-        if (isRaw) {
-            // Try embedded preview (usually a JPEG) – fast and great for thumbnails.
-            if (RawLoader::loadEmbeddedPreview(m_path, rawImage)) {
-                rawLoaded = true;
-            } else {
-                // Fallback: half-size demosaic for speed/memory.
-                rawLoaded = RawLoader::loadDemosaiced(m_path, rawImage, /*halfSize=*/true);
-            }
-        }
+    QImage image;
+    if (RawLoader::loadEmbeddedPreview(path, image, targetSize, cancel))
+        return fitTo(image, targetSize);
+    if (cancel && cancel->load(std::memory_order_relaxed))
+        return QImage();
+    if (RawLoader::loadDemosaiced(path, image, /*halfSize=*/true, cancel))
+        return fitTo(image, targetSize);
+#else
+    Q_UNUSED(path);
+    Q_UNUSED(targetSize);
+    Q_UNUSED(cancel);
+#endif
+    return QImage();
+}
 
-        if (rawLoaded && !rawImage.isNull()) {
-            if (m_targetSize.isValid() && m_targetSize.width() > 0 && m_targetSize.height() > 0) {
-                rawImage = rawImage.scaled(m_targetSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            }
-            emit this->loaded(m_index, m_path, rawImage);
-            return;
-        }
-    }
+QImage ImageLoader::loadDemosaiced(const QString &path, bool halfSize, QSize targetSize,
+                                   const std::atomic_bool *cancel)
+{
+#ifdef HAVE_LIBRAW
+    QImage image;
+    if (RawLoader::loadDemosaiced(path, image, halfSize, cancel))
+        return fitTo(image, targetSize);
 #else
-    Q_UNUSED(isRaw);
+    Q_UNUSED(path);
+    Q_UNUSED(halfSize);
+    Q_UNUSED(targetSize);
+    Q_UNUSED(cancel);
 #endif
+    return QImage();
+}
 
-    // 4) Emit a simple placeholder on failure so callers can still show something.
-    if (!isInterruptionRequested()) {
-        QImage placeholder(100, 100, QImage::Format_RGB32);
-        placeholder.fill(QColor("lightgray"));
-        emit this->loaded(m_index, m_path, placeholder);
+QImage ImageLoader::load(const QString &path, QSize targetSize, const std::atomic_bool *cancel)
+{
+    auto cancelled = [cancel] { return cancel && cancel->load(std::memory_order_relaxed); };
+    if (cancelled())
+        return QImage();
+
+    // Read the header once and go straight to the decoder for the format
+    // the file really is. Should that decoder fail, the other one gets a
+    // go: Qt can still show a RAW's TIFF thumbnail without LibRaw, and
+    // LibRaw may read a RAW whose header was not recognised.
+    const FormatRegistry::Format format = FormatRegistry::sniff(path);
+    QElapsedTimer timer;
+    timer.start();
+    QImage image;
+    if (FormatRegistry::decoderFor(format) == FormatRegistry::Decoder::Raw) {
+        // TIFF-based RAWs: the embedded JPEG straight out of the mapped
+        // file, without LibRaw opening it.
+        if (format == FormatRegistry::Format::TiffRaw && TiffPreview::load(path, image, targetSize, cancel))
+            image = fitTo(image, targetSize);
+        if (image.isNull() && !cancelled())
+            image = readWithLibRaw(path, targetSize, cancel);
+        if (image.isNull() && !cancelled())
+            image = readWithQt(path, QByteArray(), targetSize);
+    } else {
+        image = readWithQt(path, FormatRegistry::qtFormat(format), targetSize);
+        // Mislabelled or unrecognised: let Qt detect the format itself.
+        if (image.isNull() && !cancelled() && !FormatRegistry::qtFormat(format).isEmpty())
+            image = readWithQt(path, QByteArray(), targetSize);
+        if (image.isNull() && !cancelled() && isRawFile(path))
+            image = readWithLibRaw(path, targetSize, cancel);
     }
+    if (cancelled())
+        return QImage();
+    FormatRegistry::recordDecode(format, timer.nsecsElapsed(), !image.isNull());
+    return image;
 }
@@ -1,43 +1,45 @@
 // imageloader.h
 //
-// Defines the ImageLoader class used to asynchronously load
-// QImage objects on a worker thread. This helps to keep the
-// user interface responsive when dealing with large image files.
+// Declares the ImageLoader decoding routines. ImageLoader no longer owns a
+// thread; it is a set of stateless functions executed by DecodePool workers
+// so that a fixed number of threads serve every preload and thumbnail.
 
 #pragma once
 
 #include <QImage>
-#include <QThread>
 #include <QSize>
 #include <QString>
 
-// ImageLoader runs in its own QThread and emits a signal when
-// loading has finished. It does not convert to QPixmap here because
-// pixmap creation must occur on the GUI thread on some platforms.
-class ImageLoader : public QThread
-{
-    Q_OBJECT
-public:
-    // Backward-compatible: existing call sites still compile.
-    ImageLoader(int index,
-                const QString &path,
-                QObject *parent = nullptr,
-                QSize targetSize = QSize());
-    ~ImageLoader() override;
+#include <atomic>
 
-signals:
-    // Emitted when the image has been loaded. The index identifies
-    // which entry in the image list this corresponds to, and the
-    // associated file path is provided to allow keying the cache by
-    // path instead of index.
-    void loaded(int index, const QString &path, const QImage &image);
+namespace ImageLoader {
+    // Decode `path`, optionally scaled to fit `targetSize` (aspect ratio
+    // preserved, after EXIF orientation). The file's header picks the
+    // decoder (see FormatRegistry): Qt's image reader for raster formats,
+    // LibRaw for RAW files, each falling back to the other. Returns a null
+    // image if no decoder can read the file. Safe to call from any thread.
+    // QImage is returned rather than QPixmap because pixmap creation must
+    // occur on the GUI thread on some platforms.
+    //
+    // If `cancel` becomes true the decode is abandoned at the next check
+    // (between steps, and inside LibRaw's processing) and a null image is
+    // returned.
+    QImage load(const QString &path, QSize targetSize = QSize(),
+                const std::atomic_bool *cancel = nullptr);
 
-protected:
-    // QThread::run() executes in the worker thread.
-    void run() override;
+    // Demosaic a RAW file through LibRaw, at half or full resolution, then
+    // scale the result to fit `targetSize` if one is given. Used for the
+    // refinement stage that follows the fast preview. Returns a
+    // null image on failure, on cancellation, or when LibRaw is not
+    // available.
+    QImage loadDemosaiced(const QString &path, bool halfSize, QSize targetSize = QSize(),
+                          const std::atomic_bool *cancel = nullptr);
 
-private:
-    int m_index;
-    QString m_path;
-    QSize m_targetSize; // optional decode target, label size.
-};
+    // True if the file's extension names a RAW format handled by LibRaw.
+    bool isRawFile(const QString &path);
+
+    // True if the file's extension (any case) is one the browser lists:
+    // the common formats read by Qt plus every RAW format. Both come from
+    // FormatRegistry's extension table.
+    bool isImageFile(const QString &path);
+}
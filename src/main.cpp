@@ -9,6 +9,9 @@
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
+    // Application identity determines where caches and settings are stored.
+    QApplication::setOrganizationName(QStringLiteral("CullPix"));
+    QApplication::setApplicationName(QStringLiteral("CullPix"));
 
     QApplication::setWindowIcon(QIcon(":/app.ico"));
 
@@ -0,0 +1,351 @@
+// metadataindex.cpp
+
+#include "metadataindex.h"
+
+#include <QRegularExpression>
+
+#include <cmath>
+#include <utility>
+
+namespace {
+
+// Relative tolerance for "=" on the rational fields. EXIF values rarely land
+// on the nominal number: f/1.4 is often stored as 1.4142, 1/100 s as 10/998.
+constexpr double RATIONAL_TOLERANCE = 0.02;
+
+struct FieldName
+{
+    const char *name;
+    MetadataIndex::Field field;
+};
+
+constexpr FieldName FIELD_NAMES[] = {
+    { "iso", MetadataIndex::Iso },
+    { "shutter", MetadataIndex::Shutter },
+    { "exposure", MetadataIndex::Shutter },
+    { "ss", MetadataIndex::Shutter },
+    { "f", MetadataIndex::Aperture },
+    { "aperture", MetadataIndex::Aperture },
+    { "focal", MetadataIndex::Focal },
+    { "mm", MetadataIndex::Focal },
+    { "width", MetadataIndex::Width },
+    { "w", MetadataIndex::Width },
+    { "height", MetadataIndex::Height },
+    { "h", MetadataIndex::Height },
+    { "time", MetadataIndex::Time },
+    { "date", MetadataIndex::Time },
+    { "lens", MetadataIndex::Lens },
+    { "body", MetadataIndex::Body },
+    { "camera", MetadataIndex::Body },
+};
+
+MetadataIndex::Field fieldFromName(const QString &name)
+{
+    for (const FieldName &entry : FIELD_NAMES) {
+        if (name == QLatin1String(entry.name))
+            return entry.field;
+    }
+    return MetadataIndex::NoField;
+}
+
+bool isTextField(MetadataIndex::Field field)
+{
+    return field == MetadataIndex::Lens || field == MetadataIndex::Body;
+}
+
+MetadataIndex::Op opFromString(const QString &op)
+{
+    if (op == QLatin1String("<"))
+        return MetadataIndex::Less;
+    if (op == QLatin1String("<="))
+        return MetadataIndex::LessEqual;
+    if (op == QLatin1String("!="))
+        return MetadataIndex::NotEqual;
+    if (op == QLatin1String(">="))
+        return MetadataIndex::GreaterEqual;
+    if (op == QLatin1String(">"))
+        return MetadataIndex::Greater;
+    return MetadataIndex::Equal;    // "=" and ":"
+}
+
+// Parse a numeric value, accepting the units people type: "85mm",
+// "f/1.4", "1/250", "2s".
+bool parseValue(MetadataIndex::Field field, QString text, double &out)
+{
+    text = text.trimmed().toLower();
+    if (field == MetadataIndex::Aperture) {
+        if (text.startsWith(QLatin1String("f/")))
+            text.remove(0, 2);
+        else if (text.startsWith(QLatin1Char('f')))
+            text.remove(0, 1);
+    } else if (field == MetadataIndex::Focal && text.endsWith(QLatin1String("mm"))) {
+        text.chop(2);
+    } else if (field == MetadataIndex::Shutter && text.endsWith(QLatin1Char('s'))) {
+        text.chop(1);
+    }
+    bool ok = false;
+    const int slash = field == MetadataIndex::Shutter ? text.indexOf(QLatin1Char('/')) : -1;
+    if (slash >= 0) {
+        bool denominatorOk = false;
+        const double numerator = text.left(slash).toDouble(&ok);
+        const double denominator = text.mid(slash + 1).toDouble(&denominatorOk);
+        ok = ok && denominatorOk && denominator > 0;
+        out = ok ? numerator / denominator : 0.0;
+    } else {
+        out = text.toDouble(&ok);
+    }
+    return ok && out >= 0;
+}
+
+// Split on whitespace outside double quotes; the quotes are dropped.
+QStringList tokenize(const QString &text)
+{
+    QStringList tokens;
+    QString current;
+    bool quoted = false;
+    for (QChar c : text) {
+        if (c == QLatin1Char('"')) {
+            quoted = !quoted;
+        } else if (c.isSpace() && !quoted) {
+            if (!current.isEmpty())
+                tokens.append(std::exchange(current, QString()));
+        } else {
+            current.append(c);
+        }
+    }
+    if (!current.isEmpty())
+        tokens.append(current);
+    return tokens;
+}
+
+// AND `test` over one column into `mask`. Zero marks an unknown value and
+// never matches.
+template <typename T, typename Test>
+void narrow(std::vector<uchar> &mask, const std::vector<T> &column, Test test)
+{
+    const size_t rows = column.size();
+    for (size_t row = 0; row < rows; ++row) {
+        const double x = double(column[row]);
+        mask[row] &= uchar(x > 0 && test(x));
+    }
+}
+
+template <typename T>
+void narrow(std::vector<uchar> &mask, const std::vector<T> &column, const MetadataIndex::Predicate &p,
+            double tolerance)
+{
+    const double v = p.value;
+    const double slack = v * tolerance;
+    switch (p.op) {
+    case MetadataIndex::Less:
+        narrow(mask, column, [=](double x) { return x < v - slack; });
+        break;
+    case MetadataIndex::LessEqual:
+        narrow(mask, column, [=](double x) { return x <= v + slack; });
+        break;
+    case MetadataIndex::Equal:
+        narrow(mask, column, [=](double x) { return std::abs(x - v) <= slack; });
+        break;
+    case MetadataIndex::NotEqual:
+        narrow(mask, column, [=](double x) { return std::abs(x - v) > slack; });
+        break;
+    case MetadataIndex::GreaterEqual:
+        narrow(mask, column, [=](double x) { return x >= v - slack; });
+        break;
+    case MetadataIndex::Greater:
+        narrow(mask, column, [=](double x) { return x > v + slack; });
+        break;
+    }
+}
+
+// Text predicates are resolved against the (small) dictionary once; the
+// column scan then only looks up one byte per row.
+void narrowText(std::vector<uchar> &mask, const std::vector<quint16> &column, const QStringList &names,
+                const MetadataIndex::Predicate &p)
+{
+    std::vector<uchar> hit(size_t(names.size()), 0);
+    for (qsizetype id = 1; id < names.size(); ++id) {
+        const bool found = names.at(id).contains(p.text, Qt::CaseInsensitive);
+        hit[size_t(id)] = uchar(p.op == MetadataIndex::NotEqual ? !found : found);
+    }
+    const size_t rows = column.size();
+    for (size_t row = 0; row < rows; ++row)
+        mask[row] &= column[row] < hit.size() ? hit[column[row]] : uchar(0);
+}
+
+} // namespace
+
+void MetadataIndex::insert(const QString &path, const ExifMetadata &metadata)
+{
+    int row = rowOf(path);
+    if (row < 0) {
+        row = rowCount();
+        m_rowOf.insert(path, row);
+        m_iso.push_back(0);
+        m_shutter.push_back(0.0f);
+        m_aperture.push_back(0.0f);
+        m_focal.push_back(0.0f);
+        m_width.push_back(0);
+        m_height.push_back(0);
+        m_time.push_back(0);
+        m_lens.push_back(0);
+        m_body.push_back(0);
+    }
+    const size_t r = size_t(row);
+    m_iso[r] = metadata.iso;
+    m_shutter[r] = metadata.exposure;
+    m_aperture[r] = metadata.aperture;
+    m_focal[r] = metadata.focalLength;
+    m_width[r] = metadata.width;
+    m_height[r] = metadata.height;
+    m_time[r] = metadata.captureTime;
+    m_lens[r] = intern(metadata.lens, m_lensNames, m_lensIds);
+    m_body[r] = intern(metadata.body, m_bodyNames, m_bodyIds);
+}
+
+void MetadataIndex::clear()
+{
+    m_iso.clear();
+    m_shutter.clear();
+    m_aperture.clear();
+    m_focal.clear();
+    m_width.clear();
+    m_height.clear();
+    m_time.clear();
+    m_lens.clear();
+    m_body.clear();
+    m_lensNames.clear();
+    m_lensIds.clear();
+    m_bodyNames.clear();
+    m_bodyIds.clear();
+    m_rowOf.clear();
+}
+
+quint16 MetadataIndex::intern(const QString &name, QStringList &names, QHash<QString, quint16> &ids)
+{
+    if (name.isEmpty())
+        return 0;
+    auto it = ids.constFind(name);
+    if (it != ids.constEnd())
+        return it.value();
+    if (names.isEmpty())
+        names.append(QString());    // id 0: unknown
+    if (names.size() > 0xFFFF)
+        return 0;
+    const quint16 id = quint16(names.size());
+    names.append(name);
+    ids.insert(name, id);
+    return id;
+}
+
+double MetadataIndex::value(int row, Field field) const
+{
+    if (row < 0 || row >= rowCount())
+        return 0.0;
+    const size_t r = size_t(row);
+    switch (field) {
+    case Iso: return m_iso[r];
+    case Shutter: return m_shutter[r];
+    case Aperture: return m_aperture[r];
+    case Focal: return m_focal[r];
+    case Width: return m_width[r];
+    case Height: return m_height[r];
+    case Time: return double(m_time[r]);
+    case Lens: return m_lens[r];
+    case Body: return m_body[r];
+    case NoField: break;
+    }
+    return 0.0;
+}
+
+MetadataIndex::Query MetadataIndex::parse(const QString &text, QString *error)
+{
+    static const QRegularExpression spacedOp(QStringLiteral("\\s*(<=|>=|!=|<|>|=|:)\\s*"));
+    static const QRegularExpression term(QStringLiteral("^([a-z]+)(<=|>=|!=|<|>|=|:)(.+)$"),
+                                         QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression focalShorthand(QStringLiteral("^\\d+(\\.\\d+)?mm$"),
+                                                   QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression apertureShorthand(QStringLiteral("^f/?\\d+(\\.\\d+)?$"),
+                                                      QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression isoShorthand(QStringLiteral("^iso\\d+$"),
+                                                 QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression shutterShorthand(QStringLiteral("^1/\\d+s?$"),
+                                                     QRegularExpression::CaseInsensitiveOption);
+
+    Query query;
+    auto fail = [&](const QString &message) {
+        if (error)
+            *error = message;
+        return Query();
+    };
+
+    QString normalized = text;
+    normalized.replace(spacedOp, QStringLiteral("\\1"));
+    for (const QString &token : tokenize(normalized)) {
+        Predicate p;
+        QString value;
+        if (token.startsWith(QLatin1String("sort:"), Qt::CaseInsensitive)) {
+            QString name = token.mid(5).toLower();
+            query.sortDescending = name.startsWith(QLatin1Char('-'));
+            if (query.sortDescending)
+                name.remove(0, 1);
+            query.sortField = fieldFromName(name);
+            if (query.sortField == NoField)
+                return fail(QObject::tr("Unknown sort field \"%1\"").arg(name));
+            continue;
+        } else if (const QRegularExpressionMatch m = term.match(token); m.hasMatch()) {
+            p.field = fieldFromName(m.captured(1).toLower());
+            if (p.field == NoField)
+                return fail(QObject::tr("Unknown field \"%1\"").arg(m.captured(1)));
+            p.op = opFromString(m.captured(2));
+            value = m.captured(3);
+        } else if (focalShorthand.match(token).hasMatch()) {
+            p.field = Focal;
+            value = token;
+        } else if (apertureShorthand.match(token).hasMatch()) {
+            p.field = Aperture;
+            value = token;
+        } else if (isoShorthand.match(token).hasMatch()) {
+            p.field = Iso;
+            value = token.mid(3);
+        } else if (shutterShorthand.match(token).hasMatch()) {
+            p.field = Shutter;
+            value = token;
+        } else {
+            return fail(QObject::tr("Cannot read \"%1\"").arg(token));
+        }
+
+        if (p.field == Time)
+            return fail(QObject::tr("Capture time can only be sorted on (sort:time)"));
+        if (isTextField(p.field)) {
+            if (p.op != Equal && p.op != NotEqual)
+                return fail(QObject::tr("\"%1\" only supports : and !=").arg(token));
+            p.text = value;
+        } else if (!parseValue(p.field, value, p.value)) {
+            return fail(QObject::tr("Bad value in \"%1\"").arg(token));
+        }
+        query.predicates.push_back(p);
+    }
+    return query;
+}
+
+std::vector<uchar> MetadataIndex::match(const Query &query) const
+{
+    std::vector<uchar> mask(size_t(rowCount()), 1);
+    for (const Predicate &p : query.predicates) {
+        switch (p.field) {
+        case Iso: narrow(mask, m_iso, p, 0.0); break;
+        case Shutter: narrow(mask, m_shutter, p, RATIONAL_TOLERANCE); break;
+        case Aperture: narrow(mask, m_aperture, p, RATIONAL_TOLERANCE); break;
+        case Focal: narrow(mask, m_focal, p, RATIONAL_TOLERANCE); break;
+        case Width: narrow(mask, m_width, p, 0.0); break;
+        case Height: narrow(mask, m_height, p, 0.0); break;
+        case Lens: narrowText(mask, m_lens, m_lensNames, p); break;
+        case Body: narrowText(mask, m_body, m_bodyNames, p); break;
+        case Time:
+        case NoField:
+            break;
+        }
+    }
+    return mask;
+}
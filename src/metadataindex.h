@@ -0,0 +1,103 @@
+// metadataindex.h
+//
+// Declares MetadataIndex, the in-memory store of shooting metadata behind
+// the filter box. Each field lives in its own column (a plain vector, one
+// entry per indexed file) and lens and body names are interned into small
+// dictionaries, so a filter is a tight scan over one or two arrays rather
+// than a walk over per-file objects and strings. Filter text is parsed
+// once into a Query, e.g. "iso>6400", "85mm f/1.4", "lens:sigma sort:-iso".
+// Like ImageCache it is not thread-safe and is meant for the GUI thread;
+// ExifScanner does the reading.
+
+#pragma once
+
+#include "exifscanner.h"
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+#include <vector>
+
+class MetadataIndex
+{
+public:
+    enum Field
+    {
+        Iso,
+        Shutter,
+        Aperture,
+        Focal,
+        Width,
+        Height,
+        Time,
+        Lens,
+        Body,
+        NoField = -1
+    };
+
+    enum Op { Less, LessEqual, Equal, NotEqual, GreaterEqual, Greater };
+
+    struct Predicate
+    {
+        Field field = NoField;
+        Op op = Equal;
+        double value = 0.0;     // numeric fields
+        QString text;           // Lens and Body: case-insensitive substring
+    };
+
+    struct Query
+    {
+        std::vector<Predicate> predicates;
+        Field sortField = NoField;
+        bool sortDescending = false;
+
+        bool hasPredicates() const { return !predicates.empty(); }
+    };
+
+    // Add or replace the metadata for `path`.
+    void insert(const QString &path, const ExifMetadata &metadata);
+    // Forget `path`, e.g. after the file was overwritten. Its row stays
+    // allocated until clear().
+    void remove(const QString &path) { m_rowOf.remove(path); }
+    void clear();
+
+    bool contains(const QString &path) const { return m_rowOf.contains(path); }
+    // Row of `path` in the columns, or -1.
+    int rowOf(const QString &path) const { return m_rowOf.value(path, -1); }
+    int rowCount() const { return static_cast<int>(m_time.size()); }
+
+    // Numeric value of `field` at `row`, for sorting. Lens and Body give
+    // their dictionary id. 0 means unknown, except for Time.
+    double value(int row, Field field) const;
+
+    // Parse filter text. Terms are separated by spaces and all must hold;
+    // spaces around operators are allowed ("iso > 6400"). On a syntax error
+    // returns an empty query and sets `error`.
+    static Query parse(const QString &text, QString *error = nullptr);
+
+    // One flag per row: 1 if the row satisfies every predicate of `query`.
+    // Unknown values (a missing tag) never match.
+    std::vector<uchar> match(const Query &query) const;
+
+private:
+    quint16 intern(const QString &name, QStringList &names, QHash<QString, quint16> &ids);
+
+    // The columns, all rowCount() long.
+    std::vector<quint32> m_iso;
+    std::vector<float> m_shutter;
+    std::vector<float> m_aperture;
+    std::vector<float> m_focal;
+    std::vector<quint32> m_width;
+    std::vector<quint32> m_height;
+    std::vector<qint64> m_time;
+    std::vector<quint16> m_lens;    // index into m_lensNames, 0 = unknown
+    std::vector<quint16> m_body;    // index into m_bodyNames, 0 = unknown
+
+    QStringList m_lensNames;
+    QHash<QString, quint16> m_lensIds;
+    QStringList m_bodyNames;
+    QHash<QString, quint16> m_bodyIds;
+
+    QHash<QString, int> m_rowOf;
+};
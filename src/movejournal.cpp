@@ -0,0 +1,344 @@
+// movejournal.cpp
+//
+// Record framing, all little-endian:
+//
+//   u32  payload length
+//   u16  CRC-16 (qChecksum) of the payload
+//   payload: u8 type, u64 move id, i32 index, source, destination
+//            (QDataStream strings), i64 size, i64 modification time
+
+#include "movejournal.h"
+#include "fileworker.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QRandomGenerator>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#include <utility>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr int FRAME_HEADER_BYTES = 6;
+// Anything larger is corruption, not two long paths.
+constexpr quint32 MAX_PAYLOAD_BYTES = 1 << 20;
+
+} // namespace
+
+MoveJournal::MoveJournal()
+    : m_thread(&MoveJournal::run, this)
+{
+}
+
+MoveJournal::~MoveJournal()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    if (m_thread.joinable())
+        m_thread.join();
+    close();
+}
+
+QString MoveJournal::pathFor(const QString &directory)
+{
+    const QByteArray key = QCryptographicHash::hash(QDir(directory).absolutePath().toUtf8(),
+                                                    QCryptographicHash::Sha1).toHex();
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation))
+        .filePath(QStringLiteral("journals/%1.log").arg(QString::fromLatin1(key)));
+}
+
+quint64 MoveJournal::newMoveId()
+{
+    quint64 id = 0;
+    while (id == 0)
+        id = QRandomGenerator::global()->generate64();
+    return id;
+}
+
+QByteArray MoveJournal::encode(const Record &record)
+{
+    QByteArray payload;
+    {
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_0);
+        out.setByteOrder(QDataStream::LittleEndian);
+        out << quint8(record.type) << record.moveId << record.index << record.source << record.destination
+            << record.size << record.modified;
+    }
+    QByteArray frame(FRAME_HEADER_BYTES, Qt::Uninitialized);
+    qToLittleEndian<quint32>(quint32(payload.size()), frame.data());
+    qToLittleEndian<quint16>(qChecksum(payload), frame.data() + 4);
+    return frame + payload;
+}
+
+bool MoveJournal::sync(QFile &file)
+{
+    if (!file.flush())
+        return false;
+#ifdef Q_OS_WIN
+    return ::FlushFileBuffers(reinterpret_cast<HANDLE>(::_get_osfhandle(file.handle()))) != 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+
+std::vector<MoveJournal::Record> MoveJournal::open(const QString &path)
+{
+    close();
+    std::vector<Record> records;
+    std::lock_guard<std::mutex> fileLock(m_fileMutex);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        qWarning() << "MoveJournal: cannot open" << path << m_file.errorString();
+        return records;
+    }
+
+    const QByteArray data = m_file.readAll();
+    qsizetype pos = 0;
+    while (pos + FRAME_HEADER_BYTES <= data.size()) {
+        const quint32 length = qFromLittleEndian<quint32>(data.constData() + pos);
+        const quint16 checksum = qFromLittleEndian<quint16>(data.constData() + pos + 4);
+        if (length > MAX_PAYLOAD_BYTES || pos + FRAME_HEADER_BYTES + qsizetype(length) > data.size())
+            break;
+        const QByteArray payload = data.mid(pos + FRAME_HEADER_BYTES, length);
+        if (qChecksum(payload) != checksum)
+            break;
+        QDataStream in(payload);
+        in.setVersion(QDataStream::Qt_6_0);
+        in.setByteOrder(QDataStream::LittleEndian);
+        Record record;
+        quint8 type = 0;
+        in >> type >> record.moveId >> record.index >> record.source >> record.destination;
+        // Journals written before the size and time were recorded end here.
+        if (!in.atEnd())
+            in >> record.size >> record.modified;
+        if (in.status() != QDataStream::Ok)
+            break;
+        record.type = RecordType(type);
+        records.push_back(record);
+        pos += FRAME_HEADER_BYTES + length;
+    }
+    // Drop a torn tail so new records follow the last intact one.
+    if (pos < data.size()) {
+        m_file.resize(pos);
+        sync(m_file);
+    }
+    m_file.seek(pos);
+    return records;
+}
+
+void MoveJournal::close()
+{
+    // Let the commit thread write out everything appended so far.
+    quint64 appended = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        appended = m_appended;
+    }
+    waitDurable(appended);
+    std::lock_guard<std::mutex> fileLock(m_fileMutex);
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+bool MoveJournal::rewrite(const std::vector<Record> &records)
+{
+    quint64 appended = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        appended = m_appended;
+    }
+    waitDurable(appended);
+    std::lock_guard<std::mutex> fileLock(m_fileMutex);
+    if (!m_file.isOpen())
+        return false;
+    QByteArray data;
+    for (const Record &record : records)
+        data += encode(record);
+    const bool ok = m_file.resize(0) && m_file.seek(0) && m_file.write(data) == data.size() && sync(m_file);
+    if (!ok)
+        qWarning() << "MoveJournal: cannot rewrite" << m_file.fileName() << m_file.errorString();
+    return ok;
+}
+
+quint64 MoveJournal::append(const Record &record)
+{
+    const QByteArray frame = encode(record);
+    quint64 sequence = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_buffer += frame;
+        sequence = ++m_appended;
+    }
+    m_wake.notify_one();
+    return sequence;
+}
+
+void MoveJournal::waitDurable(quint64 sequence)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_committedCv.wait(lock, [this, sequence] { return m_committed >= sequence || m_stopping; });
+}
+
+quint64 MoveJournal::lastSequence()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_appended;
+}
+
+void MoveJournal::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wake.wait(lock, [this] { return m_stopping || !m_buffer.isEmpty(); });
+        if (m_buffer.isEmpty())
+            break;      // stopping, and everything has been committed
+        // Everything appended while the previous batch was being synced goes
+        // out together, with a single fsync.
+        const QByteArray batch = std::exchange(m_buffer, QByteArray());
+        const quint64 upTo = m_appended;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> fileLock(m_fileMutex);
+            if (m_file.isOpen()) {
+                if (m_file.write(batch) != batch.size() || !sync(m_file))
+                    qWarning() << "MoveJournal: write failed" << m_file.fileName() << m_file.errorString();
+            }
+        }
+        lock.lock();
+        // A failed write is logged rather than holding up every move.
+        m_committed = upTo;
+        m_committedCv.notify_all();
+    }
+}
+
+std::vector<MoveJournal::RecoveredMove> MoveJournal::recover(const std::vector<Record> &records)
+{
+    enum class Undo
+    {
+        None,
+        Requested,
+        Done
+    };
+    struct MoveState
+    {
+        Record move;
+        bool done = false;
+        bool failed = false;
+        Undo undo = Undo::None;
+    };
+    std::vector<MoveState> moves;
+    QHash<quint64, size_t> byId;
+    for (const Record &record : records) {
+        if (record.type == Move) {
+            byId.insert(record.moveId, moves.size());
+            moves.push_back({ record });
+            continue;
+        }
+        // Outcomes for moves of another folder's journal are ignored.
+        auto it = byId.constFind(record.moveId);
+        if (it == byId.constEnd())
+            continue;
+        MoveState &state = moves[it.value()];
+        switch (record.type) {
+        case MoveDone:
+            state.done = true;
+            if (!record.destination.isEmpty())
+                state.move.destination = record.destination;
+            break;
+        case MoveFailed:
+            state.failed = true;
+            break;
+        case Undone:
+            state.undo = Undo::Requested;
+            break;
+        case UndoDone:
+            state.undo = Undo::Done;
+            break;
+        case UndoFailed:
+            state.undo = Undo::None;    // may be undone again later
+            break;
+        case Renamed:
+            state.move.destination = record.destination;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // The moved file, as opposed to an unrelated one that took its name.
+    auto isMovedFile = [](const Record &move, const QString &path) {
+        const QFileInfo fi(path);
+        return move.size >= 0 && fi.exists() && fi.size() == move.size
+               && fi.lastModified().toMSecsSinceEpoch() == move.modified;
+    };
+
+    std::vector<RecoveredMove> recovered;
+    for (const MoveState &state : moves) {
+        if (state.failed || state.undo == Undo::Done)
+            continue;
+        const Record &move = state.move;
+        if (state.done && state.undo == Undo::None) {
+            recovered.push_back({ move, false, false });
+            continue;
+        }
+        // A cross-device copy only appears under its final name once it is
+        // complete; one cut off midway left just its temporary file.
+        QFile::remove(FileWorker::partialCopyPath(move.source, move.destination));
+        const bool atSource = QFileInfo::exists(move.source);
+        if (state.undo == Undo::Requested) {
+            QFile::remove(FileWorker::partialCopyPath(move.destination, move.source));
+            // An undo only starts once the move is recorded as done, so
+            // without that record only the move may have run.
+            const bool movedToDestination = isMovedFile(move, move.destination);
+            if (!state.done) {
+                if (atSource && movedToDestination)
+                    QFile::remove(move.destination);   // copied, source not unlinked yet
+                else if (movedToDestination)
+                    recovered.push_back({ move, false, true });
+                continue;
+            }
+            // The destination is ours: the move was recorded as done. A copy
+            // back that landed before the destination was unlinked leaves
+            // the same file at both ends.
+            const bool atDestination = QFileInfo::exists(move.destination);
+            if (atDestination && isMovedFile(move, move.source))
+                QFile::remove(move.destination);
+            else if (atDestination)
+                recovered.push_back({ move, false, true });
+            // Only at the source: the undo went through.
+            continue;
+        }
+        const bool movedToDestination = isMovedFile(move, move.destination);
+        if (atSource && movedToDestination) {
+            // A cross-device copy that landed before the source was
+            // unlinked: finish the move.
+            QFile::remove(move.source);
+            recovered.push_back({ move, false, false });
+        } else if (movedToDestination) {
+            recovered.push_back({ move, false, false });   // done, but not yet recorded
+        } else if (atSource) {
+            // Not moved. Whatever is at the destination (if anything) is
+            // another file; the worker picks a free name again.
+            recovered.push_back({ move, true, false });
+        }
+        // Neither: the file was removed by hand; nothing left to do.
+    }
+    return recovered;
+}
@@ -0,0 +1,128 @@
+// movejournal.h
+//
+// Declares MoveJournal, the crash-safe record of keep/reject decisions for
+// a source folder. Every move, its outcome and every undo is appended to a
+// binary log as a length-prefixed, checksummed record. Appends only copy
+// the record into a buffer; a commit thread writes whatever has built up
+// and syncs it to disk with one fsync per batch (group commit), so the
+// journal never limits how fast images can be culled. The file worker waits
+// for a move's record to be durable before touching the file, making the
+// journal a write-ahead log. When a folder is opened again, recover()
+// works out from the log and the file system which moves completed, which
+// must be carried out again and which were undone.
+
+#pragma once
+
+#include <QFile>
+#include <QString>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class MoveJournal
+{
+public:
+    enum RecordType : quint8
+    {
+        Move = 1,       // a keep/reject decision: `source` -> `destination`
+        MoveDone = 2,   // the file worker completed move `moveId`, to
+                        // `destination` if set (a taken name was suffixed)
+        MoveFailed = 3, // ... or gave up on it; the file was not moved
+        Undone = 4,     // the user undid move `moveId`; the file worker
+                        // moves it back once this record is durable
+        UndoDone = 5,   // the file is back at `source`
+        UndoFailed = 6, // the file stayed at `destination`; the move is
+                        // still in effect
+        Renamed = 7     // the reserved name was taken; the file worker
+                        // tries `destination` instead once this is durable
+    };
+
+    struct Record
+    {
+        RecordType type = Move;
+        quint64 moveId = 0;
+        qint32 index = 0;       // row of the image when it was moved
+        QString source;         // Move records only
+        QString destination;    // Move, MoveDone and Renamed records
+        // Move records only: size and modification time (ms since the
+        // epoch) of the source when the move was decided. A copy keeps
+        // both, so recovery can tell the moved file from another one that
+        // has the same name. A negative size means unknown.
+        qint64 size = -1;
+        qint64 modified = 0;
+    };
+
+    // A move that is still in effect once the journal has been replayed
+    // against the disk. `pending` moves were decided but never carried out
+    // (or were cut off mid-copy, in which case the temporary copy has been
+    // removed) and have to be queued again. `undoPending` moves were carried
+    // out and undone, but the file has not been moved back yet; the undo has
+    // to be queued again.
+    struct RecoveredMove
+    {
+        Record move;
+        bool pending = false;
+        bool undoPending = false;
+    };
+
+    MoveJournal();
+    ~MoveJournal();
+
+    // Commit what is buffered for the current journal and switch to the one
+    // at `path`, returning its records. A torn record at the end (the
+    // process died mid-write) is cut off.
+    std::vector<Record> open(const QString &path);
+    void close();
+
+    // Replace the journal's contents with `records` and sync them; used to
+    // compact it after recovery.
+    bool rewrite(const std::vector<Record> &records);
+
+    // Buffer a record for the next group commit. Returns its sequence
+    // number for waitDurable(). Thread-safe and never waits for the disk.
+    quint64 append(const Record &record);
+
+    // Block until the record with `sequence` has been synced (or dropped
+    // because no journal is open).
+    void waitDurable(quint64 sequence);
+    // Sequence number of the record appended last.
+    quint64 lastSequence();
+
+    // A fresh move id. Ids are random so records that reach another folder's
+    // journal (a move finishing after the folder was switched) never match.
+    static quint64 newMoveId();
+
+    // Work out the state of every move in `records` and return those still
+    // in effect, oldest first: the undo history. Only the moves or undos
+    // without a recorded outcome are checked against the disk, and a file
+    // found there only counts as the moved one if its size and modification
+    // time match the Move record. Besides the file worker's temporary copies,
+    // recovery only ever deletes a file it has identified that way, and
+    // only when the same file also exists at the other end.
+    static std::vector<RecoveredMove> recover(const std::vector<Record> &records);
+
+    // Journal file for the source folder `directory`, in the per-user data
+    // location.
+    static QString pathFor(const QString &directory);
+
+private:
+    void run();
+    static QByteArray encode(const Record &record);
+    static bool sync(QFile &file);
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_committedCv;
+    QByteArray m_buffer;
+    quint64 m_appended = 0;
+    quint64 m_committed = 0;
+    bool m_stopping = false;
+
+    // Only touched by the commit thread, or under m_fileMutex.
+    std::mutex m_fileMutex;
+    QFile m_file;
+
+    std::thread m_thread;
+};
@@ -0,0 +1,87 @@
+// nameindex.cpp
+
+#include "nameindex.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+
+NameIndex::NameIndex()
+    : m_names(std::make_shared<Names>())
+{
+}
+
+NameIndex::~NameIndex()
+{
+    cancel();
+}
+
+void NameIndex::cancel()
+{
+    if (m_cancelled)
+        m_cancelled->store(true);
+    m_cancelled.reset();
+}
+
+QString NameIndex::suffixed(const QString &fileName, int counter)
+{
+    const QFileInfo fi(fileName);
+    const QString suffix = fi.suffix();
+    return suffix.isEmpty() ? QStringLiteral("%1_%2").arg(fi.completeBaseName()).arg(counter)
+                            : QStringLiteral("%1_%2.%3").arg(fi.completeBaseName()).arg(counter).arg(suffix);
+}
+
+void NameIndex::load(const QStringList &directories)
+{
+    cancel();
+    {
+        std::lock_guard<std::mutex> lock(m_names->mutex);
+        m_names->byDirectory.clear();
+    }
+    m_cancelled = std::make_shared<std::atomic_bool>(false);
+    std::shared_ptr<std::atomic_bool> cancelled = m_cancelled;
+    std::shared_ptr<Names> shared = m_names;
+    std::thread([directories, cancelled, shared] {
+        for (const QString &directory : directories) {
+            // Names only: QDirIterator does not stat entries unless asked.
+            QSet<QString> names;
+            QDirIterator it(directory, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+            while (it.hasNext()) {
+                if (cancelled->load())
+                    return;
+                names.insert(it.nextFileInfo().fileName().toCaseFolded());
+            }
+            // Checked under the lock: once load() has cleared the names
+            // for the next folders, nothing of this listing gets in.
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            if (cancelled->load())
+                return;
+            shared->byDirectory[directory].unite(names);
+        }
+    }).detach();
+}
+
+QString NameIndex::reserve(const QString &directory, const QString &fileName)
+{
+    std::lock_guard<std::mutex> lock(m_names->mutex);
+    QSet<QString> &names = m_names->byDirectory[directory];
+    QString candidate = fileName;
+    for (int counter = 1; names.contains(candidate.toCaseFolded()); ++counter)
+        candidate = suffixed(fileName, counter);
+    names.insert(candidate.toCaseFolded());
+    return candidate;
+}
+
+void NameIndex::insert(const QString &directory, const QString &fileName)
+{
+    std::lock_guard<std::mutex> lock(m_names->mutex);
+    m_names->byDirectory[directory].insert(fileName.toCaseFolded());
+}
+
+void NameIndex::release(const QString &directory, const QString &fileName)
+{
+    std::lock_guard<std::mutex> lock(m_names->mutex);
+    auto it = m_names->byDirectory.find(directory);
+    if (it != m_names->byDirectory.end())
+        it->remove(fileName.toCaseFolded());
+}
@@ -0,0 +1,64 @@
+// nameindex.h
+//
+// Declares NameIndex, the in-memory set of file names in the keep and
+// discard folders. performMove() resolves name collisions against it with
+// hash lookups instead of probing name_1, name_2, ... with a stat each,
+// which on a NAS-backed folder is a network round trip per probe. The
+// folders are listed once on a background thread; from then on the set
+// is kept in step with the window's own moves. Names are compared case-
+// folded, so a suffix is also added on case-sensitive file systems when
+// two names differ only in case. The file worker never overwrites an
+// existing file, so a name taken behind the index's back (another program,
+// a move made before the listing finished) costs a retry there, not data.
+
+#pragma once
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class NameIndex
+{
+public:
+    NameIndex();
+    ~NameIndex();
+
+    // Forget everything and start listing `directories` in the background.
+    // Names reserved before the listing arrives are kept.
+    void load(const QStringList &directories);
+
+    // Return a file name based on `fileName` ("name.ext", else "name_N.ext")
+    // that is free in `directory`, and mark it as taken.
+    QString reserve(const QString &directory, const QString &fileName);
+
+    // Mark `fileName` in `directory` as taken or free again.
+    void insert(const QString &directory, const QString &fileName);
+    void release(const QString &directory, const QString &fileName);
+
+    // "name.ext" with a counter: "name_3.ext".
+    static QString suffixed(const QString &fileName, int counter);
+
+private:
+    // Shared with the listing threads, which are detached rather than
+    // joined: a listing stuck on a slow share must not block the GUI
+    // thread when another folder is opened.
+    struct Names
+    {
+        std::mutex mutex;
+        // Directory -> case-folded names.
+        QHash<QString, QSet<QString>> byDirectory;
+    };
+
+    void cancel();
+
+    std::shared_ptr<Names> m_names;
+    // Set when the current listing is superseded; it then drops what it
+    // has read instead of adding it.
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+};
@@ -0,0 +1,178 @@
+// naturalsort.cpp
+//
+// Natural ("human") ordering of file names: runs of digits compare by
+// numeric value, text compares case-insensitively, and separators
+// (-, _, space, .) are ignored.  Each name is encoded once into a flat
+// byte key whose memcmp() order is the natural order, so a comparison never
+// re-parses a name or calls QChar::toLower().  Key layout:
+//
+//   one entry per token of completeBaseName():
+//     text    0x01, lower-cased UTF-16 code units (big-endian), 0x0000
+//     number  0x02, significant digit count (BE16), the significant digits
+//             (one byte each), total digit count incl. leading zeros (BE16)
+//   0x00 end of tokens, so a name whose tokens prefix another's sorts first
+//   lower-cased suffix, 0x0000
+//   lower-cased file name, 0x0000
+//   file name as is, so names that differ only in case still have an order
+//
+// Text sorts before numbers, equal numbers with fewer digits sort first
+// ("2" < "002"), and the extension and then the whole file name break ties.
+
+#include "naturalsort.h"
+
+#include <QStringView>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Below this many files the sort runs on the calling thread only.
+constexpr size_t PARALLEL_SORT_MIN = 8192;
+constexpr unsigned MAX_SORT_THREADS = 8;
+
+inline bool isSep(QChar c)
+{
+    return c == QLatin1Char('-') || c == QLatin1Char('_') || c == QLatin1Char(' ') || c == QLatin1Char('.');
+}
+
+inline void putU16(std::vector<uchar> &out, uint v)
+{
+    v = qMin(v, 0xFFFFu);
+    out.push_back(uchar(v >> 8));
+    out.push_back(uchar(v & 0xFF));
+}
+
+// Lower-cased code units followed by a 0x0000 terminator, which sorts below
+// every character so a shorter prefix comes first.
+void appendFolded(std::vector<uchar> &out, QStringView text)
+{
+    for (QChar c : text)
+        putU16(out, c.toLower().unicode());
+    putU16(out, 0);
+}
+
+void appendKey(std::vector<uchar> &out, const QFileInfo &fi)
+{
+    const QString base = fi.completeBaseName();
+    const int n = base.size();
+    int i = 0;
+    while (i < n) {
+        while (i < n && isSep(base[i]))
+            ++i;
+        if (i >= n)
+            break;
+        const int start = i;
+        if (base[i].isDigit()) {
+            while (i < n && base[i].isDigit())
+                ++i;
+            // Compare by magnitude first (number of significant digits),
+            // then digit by digit, then by the digit count including zeros.
+            int significant = start;
+            while (significant < i && base[significant].digitValue() == 0)
+                ++significant;
+            out.push_back(0x02);
+            putU16(out, uint(i - significant));
+            for (int k = significant; k < i; ++k)
+                out.push_back(uchar(base[k].digitValue()));
+            putU16(out, uint(i - start));
+        } else {
+            while (i < n && !base[i].isDigit() && !isSep(base[i]))
+                ++i;
+            out.push_back(0x01);
+            appendFolded(out, QStringView(base).mid(start, i - start));
+        }
+    }
+    out.push_back(0x00);
+    appendFolded(out, fi.suffix());
+    const QString name = fi.fileName();
+    appendFolded(out, name);
+    for (QChar c : name)
+        putU16(out, c.unicode());
+}
+
+// A key inside the arena, plus the position of its file in the input.
+struct KeyRef
+{
+    size_t offset;
+    size_t length;
+    qsizetype index;
+};
+
+inline bool keyLess(const uchar *arena, const KeyRef &a, const KeyRef &b)
+{
+    const int c = std::memcmp(arena + a.offset, arena + b.offset, std::min(a.length, b.length));
+    return c != 0 ? c < 0 : a.length < b.length;
+}
+
+} // namespace
+
+QByteArray NaturalSort::key(const QFileInfo &file)
+{
+    std::vector<uchar> encoded;
+    appendKey(encoded, file);
+    return QByteArray(reinterpret_cast<const char *>(encoded.data()), qsizetype(encoded.size()));
+}
+
+void NaturalSort::sort(QFileInfoList &files)
+{
+    const size_t count = size_t(files.size());
+    if (count < 2)
+        return;
+
+    // Encode every name once into a single arena.
+    std::vector<uchar> arena;
+    arena.reserve(count * 96);
+    std::vector<KeyRef> refs;
+    refs.reserve(count);
+    for (qsizetype i = 0; i < files.size(); ++i) {
+        const size_t offset = arena.size();
+        appendKey(arena, files.at(i));
+        refs.push_back({ offset, arena.size() - offset, i });
+    }
+
+    const uchar *keys = arena.data();
+    auto less = [keys](const KeyRef &a, const KeyRef &b) { return keyLess(keys, a, b); };
+
+    // Sort equal slices of the key references on separate threads, then
+    // merge neighbouring slices until one run remains.
+    const unsigned threads = count < PARALLEL_SORT_MIN
+                                 ? 1u
+                                 : std::clamp(std::thread::hardware_concurrency(), 1u, MAX_SORT_THREADS);
+    std::vector<size_t> bounds;
+    for (unsigned t = 0; t <= threads; ++t)
+        bounds.push_back(count * t / threads);
+    {
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::sort(refs.begin() + bounds[t], refs.begin() + bounds[t + 1], less);
+            });
+        }
+        std::sort(refs.begin() + bounds[0], refs.begin() + bounds[1], less);
+        for (std::thread &w : workers)
+            w.join();
+    }
+    for (size_t width = 1; width < threads; width *= 2) {
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t + width < threads; t += 2 * width) {
+            const size_t first = bounds[t];
+            const size_t middle = bounds[t + width];
+            const size_t last = bounds[std::min<size_t>(t + 2 * width, threads)];
+            workers.emplace_back([&, first, middle, last] {
+                std::inplace_merge(refs.begin() + first, refs.begin() + middle,
+                                   refs.begin() + last, less);
+            });
+        }
+        for (std::thread &w : workers)
+            w.join();
+    }
+
+    QFileInfoList sorted;
+    sorted.reserve(files.size());
+    for (const KeyRef &ref : refs)
+        sorted.append(files.at(ref.index));
+    files = std::move(sorted);
+}
@@ -0,0 +1,23 @@
+// naturalsort.h
+//
+// Declares the natural sort order used for the image list, so
+// "IMG_2.jpg" sorts before "IMG_10.jpg". Shared by the directory scanner,
+// which sorts each batch on its worker thread, and the window, which
+// merges batches into the list it already shows.
+
+#pragma once
+
+#include <QByteArray>
+#include <QFileInfo>
+#include <QList>
+
+namespace NaturalSort {
+    // Collation key of `file`: QByteArray's operator< (a memcmp) on two
+    // keys gives the natural order of their files. For callers that
+    // compare the same files again and again and can keep the keys.
+    QByteArray key(const QFileInfo &file);
+
+    // Sort `files` into natural order. Each name is encoded once into a
+    // shared key arena; large lists are sorted on several threads.
+    void sort(QFileInfoList &files);
+}
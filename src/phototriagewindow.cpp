@@ -6,16 +6,29 @@
 // basic undo stack.
 
 #include "phototriagewindow.h"
+#include "decodepool.h"
 #include "imageloader.h"
+#include "formatregistry.h"
 #include "fileworker.h"
+#include "movejournal.h"
+#include "thumbnailstore.h"
+#include "imagelistmodel.h"
+#include "directoryscanner.h"
+#include "naturalsort.h"
+#include "exifscanner.h"
+#include "nameindex.h"
 
 #include <QLabel>
+#include <QLineEdit>
 #include <QPushButton>
 #include <QStatusBar>
 #include <QHBoxLayout>
 #include <QVBoxLayout>
 #include <QSplitter>
-#include <QListWidget>
+#include <QListView>
+#include <QScrollBar>
+#include <QItemSelectionModel>
+#include <QScopedValueRollback>
 #include <QFileDialog>
 #include <QShortcut>
 #include <QKeySequence>
@@ -28,18 +41,19 @@
 #include <QRegularExpression>
 #include <QApplication>
 #include <QTimer>
+#include <QFileSystemWatcher>
 #include <QThread>
 #include <QIcon>
 #include <QPixmap>
-#include <QFileIconProvider>
 #include <QSet>
 #include <QQueue>
+#include <QStandardPaths>
+#include <QSettings>
+#include <QInputDialog>
 
-// RawLoader provides decoding of RAW photo formats using LibRaw.
-#ifdef HAVE_LIBRAW
-#include "rawloader.h"
-#endif
 #include <cctype>
+#include <algorithm>
+#include <utility>
 #include <QVector>
 
 
@@ -62,16 +76,16 @@ PhotoTriageWindow::PhotoTriageWindow(QWidget *parent)
             color: #E0E0E0;
             border-top: 1px solid #333;
         }
-        QListWidget {
+        QListView {
             background-color: #1A1A1A; /* someone come get lex luthor lol. */
             color: #CCCCCC;
             border: none;
         }
-        QListWidget::item {
+        QListView::item {
             padding: 8px;
             margin: 0px;
         }
-        QListWidget::item:selected {
+        QListView::item:selected {
             background-color: #264653;
             color: #FFFFFF;
         }
@@ -82,22 +96,56 @@ PhotoTriageWindow::PhotoTriageWindow(QWidget *parent)
     // splitter so the user can adjust the space between the two panes. The
     // left pane shows a thumbnail list of images; the right pane displays
     // the currently selected photo.
-    m_fileListWidget = new QListWidget(this);
-    m_fileListWidget->setViewMode(QListView::ListMode);
-    m_fileListWidget->setIconSize(QSize(80, 80));
-    m_fileListWidget->setUniformItemSizes(false);
-    m_fileListWidget->setSelectionMode(QAbstractItemView::SingleSelection);
-    connect(m_fileListWidget, &QListWidget::currentRowChanged,
-            this, &PhotoTriageWindow::onFileListSelectionChanged);
+    // Every row has the same icon size, so uniform item sizes let the view
+    // lay out tens of thousands of rows without measuring each one.
+    m_fileListModel = new ImageListModel(m_images, m_thumbnailCache, this);
+    m_fileListModel->setThumbnailRequester([this](int row) { requestThumbnail(row); });
+    m_fileListView = new QListView(this);
+    m_fileListView->setViewMode(QListView::ListMode);
+    m_fileListView->setIconSize(QSize(80, 80));
+    m_fileListView->setUniformItemSizes(true);
+    m_fileListView->setSelectionMode(QAbstractItemView::SingleSelection);
+    m_fileListView->setModel(m_fileListModel);
+    connect(m_fileListView->selectionModel(), &QItemSelectionModel::currentRowChanged,
+            this, [this](const QModelIndex &current) {
+                if (!m_syncingFileList)
+                    onFileListSelectionChanged(current.row());
+            });
+
+    m_thumbRequestTimer = new QTimer(this);
+    m_thumbRequestTimer->setSingleShot(true);
+    m_thumbRequestTimer->setInterval(0);
+    connect(m_thumbRequestTimer, &QTimer::timeout, this, &PhotoTriageWindow::scheduleThumbnails);
+    m_thumbIdleTimer = new QTimer(this);
+    m_thumbIdleTimer->setSingleShot(true);
+    m_thumbIdleTimer->setInterval(THUMB_IDLE_INTERVAL_MS);
+    connect(m_thumbIdleTimer, &QTimer::timeout, this, &PhotoTriageWindow::queueIdleThumbnails);
+    // Re-rank thumbnails whenever the set of rows on screen may have changed.
+    auto rescheduleThumbnails = [this] { m_thumbRequestTimer->start(); };
+    connect(m_fileListView->verticalScrollBar(), &QScrollBar::valueChanged, this, rescheduleThumbnails);
+    connect(m_fileListModel, &QAbstractItemModel::modelReset, this, rescheduleThumbnails);
+    connect(m_fileListModel, &QAbstractItemModel::rowsInserted, this, rescheduleThumbnails);
+    connect(m_fileListModel, &QAbstractItemModel::rowsRemoved, this, rescheduleThumbnails);
+    m_fileListView->viewport()->installEventFilter(this);
 
     m_imageLabel = new QLabel(this);
     m_imageLabel->setAlignment(Qt::AlignCenter);
     m_imageLabel->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
     m_imageLabel->setStyleSheet("background-color: #111111; color: #E0E0E0;");
+    m_imageLabel->installEventFilter(this);
+    // Takes the focus from the filter box, so the single-key shortcuts
+    // reach the window again.
+    m_imageLabel->setFocusPolicy(Qt::ClickFocus);
+
+    m_renderCache.setMaxCost(RENDER_CACHE_KB);
+    m_resizeSettleTimer = new QTimer(this);
+    m_resizeSettleTimer->setSingleShot(true);
+    m_resizeSettleTimer->setInterval(RESIZE_SETTLE_MS);
+    connect(m_resizeSettleTimer, &QTimer::timeout, this, &PhotoTriageWindow::onResizeSettled);
 
     QSplitter *splitter = new QSplitter(this);
     splitter->setOrientation(Qt::Horizontal);
-    splitter->addWidget(m_fileListWidget);
+    splitter->addWidget(m_fileListView);
     splitter->addWidget(m_imageLabel);
     splitter->setStretchFactor(0, 0);
     splitter->setStretchFactor(1, 1);
@@ -105,6 +153,27 @@ PhotoTriageWindow::PhotoTriageWindow(QWidget *parent)
 
     // Status bar
     m_statusBar = statusBar();
+    m_cacheStatusLabel = new QLabel(this);
+    m_cacheStatusLabel->setToolTip(tr("Preload cache: resident memory / budget and hit rate. Press M to change the budget."));
+    m_statusBar->addPermanentWidget(m_cacheStatusLabel);
+
+    // Size the preload cache from the saved budget and rank its entries by
+    // their distance from the current image.
+    QSettings settings;
+    const int budgetMB = qMax(64, settings.value(QStringLiteral("cache/budgetMB"), DEFAULT_CACHE_BUDGET_MB).toInt());
+    m_preloaded.setBudget(qint64(budgetMB) * 1024 * 1024);
+    m_preloaded.setDistanceFunction([this](const QString &path) {
+        return preloadRank(indexFromPath(path));
+    });
+    m_refined.setBudget(m_preloaded.budget() / 4);
+    m_refined.setDistanceFunction([this](const QString &key) {
+        return preloadRank(indexFromPath(key.left(key.lastIndexOf(QLatin1Char('|')))));
+    });
+
+    m_refineTimer = new QTimer(this);
+    m_refineTimer->setSingleShot(true);
+    m_refineTimer->setInterval(REFINE_DWELL_MS);
+    connect(m_refineTimer, &QTimer::timeout, this, &PhotoTriageWindow::onRefineTimeout);
 
     // Buttons with contemporary styling. Each button uses a distinct accent
     // color to convey its purpose. A green tone is used for "Keep", a
@@ -157,6 +226,33 @@ PhotoTriageWindow::PhotoTriageWindow(QWidget *parent)
     hbox->addWidget(m_rejectButton);
     hbox->addWidget(m_undoButton);
     hbox->addStretch(1);
+
+    // Metadata filter. Applied shortly after typing stops, or at once on
+    // Return. Return and Escape hand the keyboard back to the image view;
+    // while the box has focus Z, X and U type into it and Left/Right move
+    // its cursor.
+    m_filterEdit = new QLineEdit(this);
+    m_filterEdit->setPlaceholderText(tr("Filter, e.g. 85mm f/1.4 iso>6400 (Ctrl+F)"));
+    m_filterEdit->setClearButtonEnabled(true);
+    m_filterEdit->setMinimumWidth(280);
+    m_filterEdit->setStyleSheet("QLineEdit { background-color: #1E1E1E; color: #E0E0E0; "
+                                "border: 1px solid #333; border-radius: 6px; padding: 6px 8px; }");
+    m_filterTimer = new QTimer(this);
+    m_filterTimer->setSingleShot(true);
+    m_filterTimer->setInterval(FILTER_DELAY_MS);
+    connect(m_filterTimer, &QTimer::timeout, this, &PhotoTriageWindow::applyFilterText);
+    connect(m_filterEdit, &QLineEdit::textChanged, m_filterTimer, qOverload<>(&QTimer::start));
+    connect(m_filterEdit, &QLineEdit::returnPressed, this, [this] {
+        m_filterTimer->stop();
+        applyFilterText();
+        m_imageLabel->setFocus(Qt::ShortcutFocusReason);
+    });
+    auto sLeaveFilter = new QShortcut(QKeySequence(Qt::Key_Escape), m_filterEdit);
+    sLeaveFilter->setContext(Qt::WidgetShortcut);
+    connect(sLeaveFilter, &QShortcut::activated, this, [this] {
+        m_imageLabel->setFocus(Qt::ShortcutFocusReason);
+    });
+    hbox->addWidget(m_filterEdit);
     toolbarWidget->setLayout(hbox);
     QToolBar *tb = new QToolBar(this);
     tb->setMovable(false);
@@ -180,6 +276,9 @@ PhotoTriageWindow::PhotoTriageWindow(QWidget *parent)
     new QShortcut(QKeySequence(QStringLiteral("U")), this, SLOT(undoLastAction()));
     new QShortcut(QKeySequence(QStringLiteral("Ctrl+Z")), this, SLOT(undoLastAction()));
     new QShortcut(QKeySequence(QStringLiteral("O")), this, SLOT(chooseSourceFolder()));
+    new QShortcut(QKeySequence(QStringLiteral("M")), this, SLOT(chooseCacheBudget()));
+    new QShortcut(QKeySequence(QStringLiteral("T")), this, SLOT(toggleCaptureTimeSort()));
+    new QShortcut(QKeySequence::Find, this, SLOT(focusFilter()));
     // Arrow key shortcuts to browse images without performing any action
     new QShortcut(QKeySequence(Qt::Key_Right), this, SLOT(goToNextImage()));
     new QShortcut(QKeySequence(Qt::Key_Left), this, SLOT(goToPreviousImage()));
@@ -187,24 +286,127 @@ PhotoTriageWindow::PhotoTriageWindow(QWidget *parent)
     // Ask for source folder on startup after event loop starts
     QTimer::singleShot(0, this, &PhotoTriageWindow::chooseSourceFolder);
 
-    // Initialise asynchronous file worker
+    // Initialise asynchronous file worker and its journal
+    m_journal = new MoveJournal();
     m_fileWorker = new FileWorker();
+    m_fileWorker->setJournal(m_journal);
+    connect(m_fileWorker, &FileWorker::taskStateChanged,
+            this, &PhotoTriageWindow::onMoveStateChanged, Qt::QueuedConnection);
+
+    // Background lister for source folders
+    m_scanner = new DirectoryScanner(this);
+    connect(m_scanner, &DirectoryScanner::batchReady,
+            this, &PhotoTriageWindow::onScanBatch, Qt::QueuedConnection);
+    connect(m_scanner, &DirectoryScanner::finished,
+            this, &PhotoTriageWindow::onScanFinished, Qt::QueuedConnection);
+
+    // Watch the source folder and re-list it, on a second scanner, once
+    // changes have settled.
+    m_rescanner = new DirectoryScanner(this);
+    connect(m_rescanner, &DirectoryScanner::batchReady,
+            this, &PhotoTriageWindow::onRescanBatch, Qt::QueuedConnection);
+    connect(m_rescanner, &DirectoryScanner::finished,
+            this, &PhotoTriageWindow::onRescanFinished, Qt::QueuedConnection);
+    m_rescanTimer = new QTimer(this);
+    m_rescanTimer->setSingleShot(true);
+    m_rescanTimer->setInterval(RESCAN_DEBOUNCE_MS);
+    connect(m_rescanTimer, &QTimer::timeout, this, &PhotoTriageWindow::startRescan);
+    m_dirWatcher = new QFileSystemWatcher(this);
+    connect(m_dirWatcher, &QFileSystemWatcher::directoryChanged,
+            this, &PhotoTriageWindow::onSourceDirectoryChanged);
+    m_ownChangeClock.start();
+    m_ownChangeTimer = new QTimer(this);
+    m_ownChangeTimer->setSingleShot(true);
+    m_ownChangeTimer->setInterval(RESCAN_DEBOUNCE_MS);
+    connect(m_ownChangeTimer, &QTimer::timeout, this, &PhotoTriageWindow::expireOwnChanges);
+
+    // Background metadata indexing; capture-time ordering, if it was left
+    // switched on
+    m_sortByCaptureTime = settings.value(QStringLiteral("view/sortByCaptureTime"), false).toBool();
+    m_exifScanner = new ExifScanner(this);
+    connect(m_exifScanner, &ExifScanner::metadataReady,
+            this, &PhotoTriageWindow::onMetadataReady, Qt::QueuedConnection);
+
+    // Decode pool shared by preloads and thumbnails
+    m_decodePool = new DecodePool(0, this);
+    connect(m_decodePool, &DecodePool::decoded,
+            this, &PhotoTriageWindow::onImageDecoded,
+            Qt::QueuedConnection);
+
+    // Open the persistent thumbnail store in the per-user cache directory
+    m_thumbStore = new ThumbnailStore();
+    m_thumbStore->open(QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
+                           .filePath(QStringLiteral("thumbnails")));
 }
 
 PhotoTriageWindow::~PhotoTriageWindow()
 {
+    // Join the scan and decode threads before the window's caches go away
+    if (m_scanner) {
+        m_scanner->cancel();
+    }
+    if (m_rescanner) {
+        m_rescanner->cancel();
+    }
+    if (m_exifScanner) {
+        m_exifScanner->cancel();
+    }
+    if (m_decodePool) {
+        m_decodePool->stop();
+    }
     // Stop and delete the file worker
     if (m_fileWorker) {
         m_fileWorker->stop();
         delete m_fileWorker;
         m_fileWorker = nullptr;
     }
+    // Outcomes logged by the worker's last moves are committed on the way out
+    delete m_journal;
+    m_journal = nullptr;
+    // Deleting the store writes its index back to disk
+    delete m_thumbStore;
+    m_thumbStore = nullptr;
 }
 
-void PhotoTriageWindow::resizeEvent(QResizeEvent *event)
+bool PhotoTriageWindow::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == m_imageLabel && event->type() == QEvent::Resize) {
+        onViewportResized();
+    } else if (m_fileListView && watched == m_fileListView->viewport() && event->type() == QEvent::Resize) {
+        m_thumbRequestTimer->start();
+    }
+    return QMainWindow::eventFilter(watched, event);
+}
+
+void PhotoTriageWindow::onViewportResized()
+{
+    // Reuse a smooth render for this exact size if one exists; otherwise
+    // stretch the last rendered frame cheaply until the resize settles.
+    if (!m_displayedPath.isEmpty() && !m_lastRendered.isNull()) {
+        const QImage image = bestImageFor(m_displayedPath, false);
+        const QSize target = displayTargetSize();
+        const QString key = QStringLiteral("%1|%2x%3|%4").arg(m_displayedPath)
+                                .arg(target.width()).arg(target.height()).arg(image.cacheKey());
+        if (QPixmap *cached = image.isNull() ? nullptr : m_renderCache.object(key)) {
+            m_imageLabel->setPixmap(*cached);
+        } else {
+            QPixmap frame = m_lastRendered.scaled(target, Qt::KeepAspectRatio, Qt::FastTransformation);
+            frame.setDevicePixelRatio(m_imageLabel->devicePixelRatioF());
+            m_imageLabel->setPixmap(frame);
+        }
+    }
+    m_resizeSettleTimer->start();
+}
+
+void PhotoTriageWindow::onResizeSettled()
 {
-    QMainWindow::resizeEvent(event);
     displayCurrentImage();
+    // Preloads and refinements decoded for a smaller label are re-requested
+    // at the new size, and stay usable until the replacements arrive.
+    // Larger ones are only scaled down when they are shown.
+    ensurePreloadWindow();
+    if (!m_displayedPath.isEmpty() && ImageLoader::isRawFile(m_displayedPath))
+        m_refineTimer->start();
 }
 
 void PhotoTriageWindow::closeEvent(QCloseEvent *event)
@@ -228,442 +430,1296 @@ void PhotoTriageWindow::chooseSourceFolder()
     }
 }
 
-static inline bool isSep(QChar c) {
-    return c == QChar('-') || c == QChar('_') || c == QChar(' ') || c == QChar('.');
-}
+void PhotoTriageWindow::loadSourceDirectory(const QString &directory)
+{
+    QDir dir(directory);
+    if (!dir.exists()) {
+        QMessageBox::warning(this, tr("Invalid Directory"), tr("%1 is not a valid directory.").arg(directory));
+        return;
+    }
+    // Swapping in an empty list invalidates every row of the list model.
+    // The images themselves arrive in batches from the scanner thread, see
+    // onScanBatch().
+    m_scanId = m_scanner->start(directory);
+    m_scanning = true;
+    // Follow later changes to the folder (tethered shooting, a card still
+    // being copied).  QFileSystemWatcher uses inotify on Linux.
+    if (!m_dirWatcher->directories().isEmpty())
+        m_dirWatcher->removePaths(m_dirWatcher->directories());
+    m_dirWatcher->addPath(directory);
+    m_rescanner->cancel();
+    m_rescanTimer->stop();
+    m_rescanning = false;
+    m_rescanPending = false;
+    m_rescanFiles.clear();
+    m_movedAway.clear();
+    m_ownChanges.clear();
+    m_ownChangeTimer->stop();
+    m_exifScanner->cancel();
+    m_metadataJobRunning = false;
+    m_metadata.clear();
+    // A filter typed for the previous folder would hide files as soon as
+    // their metadata arrives; start unfiltered.
+    m_filterTimer->stop();
+    {
+        const QSignalBlocker blocker(m_filterEdit);
+        m_filterEdit->clear();
+    }
+    m_query = MetadataIndex::Query();
+    m_filteredOut.clear();
+    m_unplaced.clear();
+    m_reorderPending = false;
+    m_sortKeys.clear();
+    m_fileListModel->beginResetImages();
+    m_images.clear();
+    m_fileListModel->endResetImages();
+    m_rowByPath.clear();
+    invalidateRowIndex(0);
+    m_currentIndex = -1;
 
-struct Token {
-    bool isNum;
-    qint64 num; // valid if isNum == true
-    int start; // begin index in source string for text
-    int len; // length of text, for numbers, this holds the digit count for tie breakers.
-};
+    m_sourceDir = directory;
+    // Prepare destination directories (siblings of source)
+    m_keepDir = QDir(directory).filePath("keep");
+    m_discardDir = QDir(directory).filePath("discard");
 
-struct SortKey{
-    QString base; // completeBaseName() (owned, so indicies remain valid)
-    QString ext; // suffic()
-    QVector<Token> tokens; // Tokens for 'base'
-};
+    // Ensure directories exist
+    QDir().mkpath(m_keepDir);
+    QDir().mkpath(m_discardDir);
+    // Names already taken there, for performMove()'s collision handling.
+    m_destNames.load({ m_keepDir, m_discardDir });
 
-static void buildTokens(const QString& s, QVector<Token>& out) {
-    out.clear();
-    const int n = s.size();
-    int i = 0;
+    // Reset state
+    m_displayedPath.clear();
+    m_refined.clear();
+    m_renderCache.clear();
+    if (m_decodePool) {
+        m_decodePool->clear();
+    }
+    m_preloaded.clear();
+    m_undecodable.clear();
+    m_thumbPending.clear();
+    m_thumbRequested.clear();
+    m_thumbBoosted.clear();
+    m_thumbIdleCursor = 0;
+    m_thumbIdleTimer->stop();
+    m_undoStack.clear();
+    m_undoing.clear();
+    m_restoring.clear();
+    m_restoredDuringRescan.clear();
+    m_recentlyMoved.clear();
+    m_statusBar->clearMessage();
+    recoverMoves();
 
-    auto skipSeps = [&](int &k){
-        while (k < n && isSep(s[k])) ++k;
-    };
+    displayCurrentImage();
+}
 
-    while (i < n) {
-        skipSeps(i);
-        if (i >= n) break;
-
-        const QChar c = s[i];
-        if (c.isDigit()) {
-            qint64 v = 0;
-            int start = i;
-            while (i < n && s[i].isDigit()) {
-                v = v * 10 + (s[i].unicode() - '0');
-                ++i;
-            }
-            Token t;
-            t.isNum = true;
-            t.num = v;
-            t.start = start;
-            t.len = i - start; // here is our digit count for the tie breaker. (ex: 2 vs 002)
-            out.push_back(t);
+void PhotoTriageWindow::recoverMoves()
+{
+    const std::vector<MoveJournal::RecoveredMove> recovered =
+        MoveJournal::recover(m_journal->open(MoveJournal::pathFor(m_sourceDir)));
+    if (recovered.empty()) {
+        m_journal->rewrite({});
+        return;
+    }
+
+    // Unfinished moves and undos are carried out again, and every move
+    // still in effect comes back as undo history.  The journal is
+    // compacted down to exactly that.
+    std::vector<MoveJournal::Record> compacted;
+    for (const MoveJournal::RecoveredMove &entry : recovered) {
+        compacted.push_back(entry.move);
+        if (!entry.pending) {
+            MoveJournal::Record done;
+            done.type = MoveJournal::MoveDone;
+            done.moveId = entry.move.moveId;
+            compacted.push_back(done);
+        }
+        if (entry.undoPending) {
+            MoveJournal::Record undone;
+            undone.type = MoveJournal::Undone;
+            undone.moveId = entry.move.moveId;
+            compacted.push_back(undone);
+        }
+    }
+    m_journal->rewrite(compacted);
+
+    int replayed = 0;
+    for (size_t i = 0; i < recovered.size(); ++i) {
+        const MoveJournal::Record &move = recovered[i].move;
+        MoveAction action;
+        action.originalPath = move.source;
+        action.destinationPath = move.destination;
+        action.index = move.index;
+        action.journalId = move.moveId;
+        action.state = static_cast<int>(FileTaskState::Done);
+        if (recovered[i].undoPending) {
+            // Moved back behind the user's back; the folder watcher lists
+            // the file once it has landed.
+            FileTask task;
+            task.source = move.destination;
+            task.destination = move.source;
+            task.journalId = move.moveId;
+            task.undo = true;
+            m_undoing.insert(m_fileWorker->enqueue(task), { action, false });
+            ++replayed;
+            continue;
         }
-        else {
-            int start = i;
-            while (i < n && !s[i].isDigit() && !isSep(s[i])) ++i;
-            Token t;
-            t.isNum = false;
-            t.num = 0;
-            t.start = start;
-            t.len = i - start;
-            out.push_back(t);
+        if (recovered[i].pending) {
+            // The Move record is already durable, so there is nothing to
+            // wait for.  The scan must not list the file meanwhile.
+            FileTask task;
+            task.source = move.source;
+            task.destination = move.destination;
+            task.journalId = move.moveId;
+            action.taskId = m_fileWorker->enqueue(task);
+            action.state = static_cast<int>(FileTaskState::Pending);
+            m_movedAway.insert(QFileInfo(move.source).absoluteFilePath());
+            // Not on disk yet, so the folder listing cannot know the name.
+            const QFileInfo dest(move.destination);
+            m_destNames.insert(dest.absolutePath(), dest.fileName());
+            ++replayed;
         }
+        m_undoStack.push(action);
     }
+    m_statusBar->showMessage(tr("Restored %n move(s) from the last session, %1 finished now.", nullptr,
+                                int(recovered.size())).arg(replayed), 5000);
 }
 
-// case insensitive compare of two text slices in 'src' without allocations
-static int cmpTextCI(const QString& srcA, int aStart, int aLen, const QString& srcB, int bStart, int bLen) {
-
-    const int L = qMin(aLen, bLen);
+void PhotoTriageWindow::onScanBatch(quint64 scanId, const QFileInfoList &files)
+{
+    if (scanId != m_scanId)
+        return;
+    // Files moved away while the scan runs (or replayed from the journal
+    // and not moved yet) are still listed; files restored by undo are
+    // already in the list.
+    if (!m_movedAway.isEmpty() || !m_undoStack.isEmpty()) {
+        QFileInfoList remaining;
+        remaining.reserve(files.size());
+        for (const QFileInfo &fi : files) {
+            const QString path = fi.absoluteFilePath();
+            if (!m_movedAway.contains(path) && indexFromPath(path) < 0)
+                remaining.append(fi);
+        }
+        insertSortedImages(remaining);
+        return;
+    }
+    insertSortedImages(files);
+}
 
-    for (int k = 0; k < L; ++k) {
-        ushort ca = srcA[aStart + k].toLower().unicode();
-        ushort cb = srcB[bStart + k].toLower().unicode();
+void PhotoTriageWindow::insertSortedImages(const QFileInfoList &files)
+{
+    if (files.isEmpty())
+        return;
 
-        if (ca != cb) {
-            return (ca < cb) ? -1 : 1;
+    // The batch is already in natural order, so each file's position in the
+    // current list is found by binary search starting from the previous
+    // file's position, and the two lists are merged in a single pass.  When
+    // ordering by metadata (capture time or a sort: term) the new files go
+    // to the end until they are indexed; settleViewOrder() then moves them
+    // into place and hides the ones a filter rejects.
+    const bool appendOnly = viewSortField() != MetadataIndex::NoField;
+    if (appendOnly || m_query.hasPredicates()) {
+        for (const QFileInfo &fi : files)
+            m_unplaced.insert(fi.absoluteFilePath());
+    }
+    // Each comparison is a memcmp of collation keys: the batch's are
+    // encoded here once, the listed rows' come from m_sortKeys.
+    auto before = [this](const QByteArray &key, const QFileInfo &row) { return key < sortKey(row); };
+    std::vector<QFileInfo> merged;
+    merged.reserve(m_images.size() + size_t(files.size()));
+    auto from = m_images.begin();
+    int firstInsert = -1;
+    int lastInsert = -1;
+    for (const QFileInfo &fi : files) {
+        const auto pos = appendOnly ? m_images.end()
+                                    : std::upper_bound(from, m_images.end(), sortKey(fi), before);
+        merged.insert(merged.end(), from, pos);
+        if (firstInsert < 0)
+            firstInsert = static_cast<int>(merged.size());
+        lastInsert = static_cast<int>(merged.size());
+        merged.push_back(fi);
+        from = pos;
+    }
+    merged.insert(merged.end(), from, m_images.end());
+    const bool contiguous = lastInsert - firstInsert + 1 == files.size();
+
+    // Keep the current image and the top of the file list in place while
+    // rows are inserted around them.
+    const QString currentPath = (m_currentIndex >= 0 && m_currentIndex < static_cast<int>(m_images.size()))
+                                    ? m_images.at(m_currentIndex).absoluteFilePath() : QString();
+    const QModelIndex top = m_fileListView->indexAt(QPoint(0, 0));
+    const QString topPath = top.isValid() ? m_images.at(top.row()).absoluteFilePath() : QString();
+    {
+        QScopedValueRollback<bool> guard(m_syncingFileList, true);
+        if (contiguous) {
+            // Typical for camera folders: the batch lands as one block (often
+            // at the end), which the view can take as a plain row insertion.
+            m_fileListModel->beginInsertImages(firstInsert, lastInsert);
+            m_images.swap(merged);
+            m_fileListModel->endInsertImages();
+        } else {
+            m_fileListModel->beginResetImages();
+            m_images.swap(merged);
+            m_fileListModel->endResetImages();
         }
     }
-    // All compared characters are equal up to the length of the shorter substring.
-    // Let the caller decide based on length or other criteria; here we indicate equality.
-    return 0;
+    invalidateRowIndex(firstInsert);
+    m_thumbIdleCursor = qMin(m_thumbIdleCursor, firstInsert);
+
+    // Show the first image as soon as any have arrived.
+    m_currentIndex = currentPath.isEmpty() ? 0 : indexFromPath(currentPath);
+    displayCurrentImage();
+    if (!topPath.isEmpty()) {
+        const int topRow = indexFromPath(topPath);
+        if (topRow >= 0)
+            m_fileListView->scrollTo(m_fileListModel->index(topRow), QAbstractItemView::PositionAtTop);
+    }
+    // Begin preloading immediately so the next few images are ready before
+    // the user navigates.
+    ensurePreloadWindow();
+    indexMetadata();
+    settleViewOrder();
 }
 
+void PhotoTriageWindow::toggleCaptureTimeSort()
+{
+    m_sortByCaptureTime = !m_sortByCaptureTime;
+    QSettings().setValue(QStringLiteral("view/sortByCaptureTime"), m_sortByCaptureTime);
+    applyViewOrder();
+    m_statusBar->showMessage(m_sortByCaptureTime ? tr("Sorted by capture time")
+                                                 : tr("Sorted by file name"), 3000);
+}
 
-static int cmpTokens(const SortKey& A, const SortKey& B) {
-    const auto& a = A.tokens;
-    const auto& b = B.tokens;
-    int ia = 0, ib = 0;
+void PhotoTriageWindow::focusFilter()
+{
+    m_filterEdit->setFocus(Qt::ShortcutFocusReason);
+    m_filterEdit->selectAll();
+}
 
-    while (ia < a.size() && ib < b.size()) {
-        const Token &ta = a[ia], &tb = b[ib];
+void PhotoTriageWindow::applyFilterText()
+{
+    QString error;
+    const MetadataIndex::Query query = MetadataIndex::parse(m_filterEdit->text(), &error);
+    if (!error.isEmpty()) {
+        m_statusBar->showMessage(tr("Filter: %1").arg(error), 5000);
+        return;
+    }
+    m_query = query;
+    applyViewOrder();
+}
 
-        if (ta.isNum && tb.isNum) {
-            if (ta.num != tb.num) return (ta.num < tb.num) ? -1 : 1;
-            // same numeric value; prefer shorter digit run (e.g., "2" < "002")
-            if (ta.len != tb.len) return (ta.len < tb.len) ? -1 : 1;
-        } else if (!ta.isNum && !tb.isNum) {
-            int c = cmpTextCI(A.base, ta.start, ta.len, B.base, tb.start, tb.len);
-            if (c != 0) return c;
-        } else {
-            // Decide whether text < number or number < text. Explorer-like feel prefers text first.
-            return ta.isNum ? 1 : -1;
+void PhotoTriageWindow::indexMetadata()
+{
+    if (m_metadataJobRunning)
+        return;
+    QStringList missing;
+    auto collect = [&](const QFileInfo &fi) {
+        const QString path = fi.absoluteFilePath();
+        if (!m_metadata.contains(path))
+            missing.append(path);
+    };
+    std::for_each(m_images.begin(), m_images.end(), collect);
+    std::for_each(m_filteredOut.begin(), m_filteredOut.end(), collect);
+    if (missing.isEmpty())
+        return;
+    m_metadataJobRunning = true;
+    m_metadataJobId = m_exifScanner->start(missing);
+}
+
+void PhotoTriageWindow::applyViewOrder()
+{
+    if (m_images.empty() && m_filteredOut.empty())
+        return;
+    const MetadataIndex::Field sortField = viewSortField();
+    QFileInfoList order;
+    order.reserve(qsizetype(m_images.size() + m_filteredOut.size()));
+    order.append(QFileInfoList(m_images.begin(), m_images.end()));
+    order.append(QFileInfoList(m_filteredOut.begin(), m_filteredOut.end()));
+
+    // Metadata is read off the GUI thread; come back (settleViewOrder())
+    // once the files that are not indexed yet have been scanned.
+    if (sortField != MetadataIndex::NoField) {
+        const bool complete = std::all_of(order.cbegin(), order.cend(), [this](const QFileInfo &fi) {
+            return m_metadata.contains(fi.absoluteFilePath());
+        });
+        if (!complete) {
+            m_reorderPending = true;
+            if (!m_metadataJobRunning)
+                indexMetadata();
+            m_statusBar->showMessage(tr("Reading metadata…"));
+            return;
+        }
+    }
+
+    // Natural order first; the metadata field then takes precedence, with
+    // the natural order breaking ties (e.g. burst frames without
+    // sub-seconds). Files missing the field sort last either way.
+    NaturalSort::sort(order);
+    std::vector<int> rows;
+    rows.reserve(size_t(order.size()));
+    // Only files still waiting for their metadata stay unplaced.
+    m_reorderPending = false;
+    m_unplaced.clear();
+    for (const QFileInfo &fi : std::as_const(order)) {
+        const QString path = fi.absoluteFilePath();
+        const int row = m_metadata.rowOf(path);
+        if (row < 0)
+            m_unplaced.insert(path);
+        rows.push_back(row);
+    }
+    if (sortField != MetadataIndex::NoField) {
+        std::vector<std::pair<double, int>> keyed;
+        keyed.reserve(size_t(order.size()));
+        for (int i = 0; i < order.size(); ++i)
+            keyed.emplace_back(m_metadata.value(rows[size_t(i)], sortField), i);
+        const bool descending = m_query.sortField != MetadataIndex::NoField && m_query.sortDescending;
+        const bool zeroIsUnknown = sortField != MetadataIndex::Time;
+        std::stable_sort(keyed.begin(), keyed.end(), [=](const auto &a, const auto &b) {
+            if (zeroIsUnknown && (a.first <= 0) != (b.first <= 0))
+                return b.first <= 0;
+            return descending ? a.first > b.first : a.first < b.first;
+        });
+        QFileInfoList sorted;
+        std::vector<int> sortedRows;
+        sorted.reserve(order.size());
+        sortedRows.reserve(rows.size());
+        for (const auto &entry : keyed) {
+            sorted.append(order.at(entry.second));
+            sortedRows.push_back(rows[size_t(entry.second)]);
         }
-        ++ia; ++ib;
+        order = std::move(sorted);
+        rows = std::move(sortedRows);
     }
 
-    // prefix rule: fewer tokens wins.
-    if (ia != ib) return (ia < ib) ? -1 : 1;
-    // Tie-break: extension (case-insensitive, simplistic is fine)
-    int c = cmpTextCI(A.ext, 0, A.ext.size(), B.ext, 0, B.ext.size());
-    if (c != 0) return c;
+    // Split off the files the filter rejects.  The whole filter is one
+    // columnar pass over the index; each file then costs a byte lookup.
+    std::vector<QFileInfo> visible;
+    std::vector<QFileInfo> hidden;
+    visible.reserve(size_t(order.size()));
+    const std::vector<uchar> mask = m_query.hasPredicates() ? m_metadata.match(m_query)
+                                                            : std::vector<uchar>();
+    for (int i = 0; i < order.size(); ++i) {
+        const int row = rows[size_t(i)];
+        const bool pass = mask.empty() || row < 0 || mask[size_t(row)];
+        (pass ? visible : hidden).push_back(order.at(i));
+    }
+    m_filteredOut = std::move(hidden);
+
+    bool same = visible.size() == m_images.size();
+    for (size_t i = 0; i < visible.size() && same; ++i)
+        same = visible[i].absoluteFilePath() == m_images[i].absoluteFilePath();
+    if (same) {
+        displayCurrentImage();
+        return;
+    }
+
+    const QString currentPath = (m_currentIndex >= 0 && m_currentIndex < static_cast<int>(m_images.size()))
+                                    ? m_images.at(m_currentIndex).absoluteFilePath() : QString();
+    const int previousIndex = m_currentIndex;
+    {
+        QScopedValueRollback<bool> guard(m_syncingFileList, true);
+        m_fileListModel->beginResetImages();
+        m_images.swap(visible);
+        m_fileListModel->endResetImages();
+    }
+    m_rowByPath.clear();
+    invalidateRowIndex(0);
+    m_thumbIdleCursor = 0;
+    // Stay on the current image; if the filter hid it, stay at about the
+    // same place in the list.
+    const int currentRow = currentPath.isEmpty() ? -1 : indexFromPath(currentPath);
+    const int count = static_cast<int>(m_images.size());
+    m_currentIndex = currentRow >= 0 ? currentRow : count == 0 ? -1 : qBound(0, previousIndex, count - 1);
+    displayCurrentImage();
+    ensurePreloadWindow();
+}
 
-    // Final fallback: compare full fileName (stable order)
-    // (This is very rarely hit; helps keep sort stable across equal keys.)
-    return 0;
+MetadataIndex::Field PhotoTriageWindow::viewSortField() const
+{
+    if (m_query.sortField != MetadataIndex::NoField)
+        return m_query.sortField;
+    return m_sortByCaptureTime ? MetadataIndex::Time : MetadataIndex::NoField;
 }
 
-static bool naturalLessKeyed(const std::pair<QFileInfo, SortKey>& A,
-                             const std::pair<QFileInfo, SortKey>& B) {
-    const int c = cmpTokens(A.second, B.second);
-    if (c != 0) return c < 0;
+void PhotoTriageWindow::settleViewOrder()
+{
+    // Reordering while the scan still streams in batches, or while their
+    // metadata is being read, would re-sort and reset the list each time.
+    if ((m_unplaced.isEmpty() && !m_reorderPending) || m_scanning || m_metadataJobRunning)
+        return;
+    if (!m_reorderPending && viewSortField() == MetadataIndex::NoField && !m_query.hasPredicates()) {
+        m_unplaced.clear();     // natural order: inserted in place already
+        return;
+    }
+    if (m_reorderPending || m_unplaced.size() > MAX_ROW_PLACEMENTS)
+        applyViewOrder();
+    else
+        placeIndexedImages();
+}
+
+void PhotoTriageWindow::placeIndexedImages()
+{
+    const MetadataIndex::Field sortField = viewSortField();
+    const std::vector<uchar> mask = m_query.hasPredicates() ? m_metadata.match(m_query)
+                                                            : std::vector<uchar>();
+    const QString currentPath = (m_currentIndex >= 0 && m_currentIndex < static_cast<int>(m_images.size()))
+                                    ? m_images.at(m_currentIndex).absoluteFilePath() : QString();
+    const int previousIndex = m_currentIndex;
+
+    // Take out the indexed files the filter rejects and, when ordering by
+    // metadata, the ones that pass; in natural order those are in place.
+    std::vector<QFileInfo> placing;
+    bool changed = false;
+    for (auto it = m_unplaced.begin(); it != m_unplaced.end(); ) {
+        const QString path = *it;
+        const int metaRow = m_metadata.rowOf(path);
+        if (metaRow < 0) {
+            ++it;
+            continue;
+        }
+        it = m_unplaced.erase(it);
+        const int row = indexFromPath(path);
+        if (row < 0)
+            continue;   // moved away or filtered out meanwhile
+        const bool pass = mask.empty() || mask[size_t(metaRow)];
+        if (pass && sortField == MetadataIndex::NoField)
+            continue;
+        const QFileInfo fi = m_images.at(row);
+        {
+            QScopedValueRollback<bool> guard(m_syncingFileList, true);
+            m_fileListModel->beginRemoveImage(row);
+            m_images.erase(m_images.begin() + row);
+            m_fileListModel->endRemoveImage();
+        }
+        m_rowByPath.remove(path);
+        invalidateRowIndex(row);
+        if (row < m_thumbIdleCursor)
+            --m_thumbIdleCursor;
+        (pass ? placing : m_filteredOut).push_back(fi);
+        changed = true;
+    }
 
-    // Fallback on full filename CI compare to stabilize exact ties:
-    const QString fa = A.first.fileName();
-    const QString fb = B.first.fileName();
-    const int L = qMin(fa.size(), fb.size());
-    for (int i = 0; i < L; ++i) {
-        ushort ca = fa[i].toLower().unicode();
-        ushort cb = fb[i].toLower().unicode();
-        if (ca != cb) return ca < cb;
+    // Same order as applyViewOrder(): the field first, files missing it
+    // last, the natural order breaking ties.
+    const bool descending = m_query.sortField != MetadataIndex::NoField && m_query.sortDescending;
+    const bool zeroIsUnknown = sortField != MetadataIndex::Time;
+    auto valueOf = [this, sortField](const QFileInfo &fi) {
+        return m_metadata.value(m_metadata.rowOf(fi.absoluteFilePath()), sortField);
+    };
+    auto before = [&](const QFileInfo &a, const QFileInfo &b) {
+        const double va = valueOf(a);
+        const double vb = valueOf(b);
+        if (zeroIsUnknown && (va <= 0) != (vb <= 0))
+            return vb <= 0;
+        if (va != vb)
+            return descending ? va > vb : va < vb;
+        return sortKey(a) < sortKey(b);
+    };
+    for (const QFileInfo &fi : placing) {
+        const int row = static_cast<int>(std::upper_bound(m_images.begin(), m_images.end(), fi, before)
+                                         - m_images.begin());
+        {
+            QScopedValueRollback<bool> guard(m_syncingFileList, true);
+            m_fileListModel->beginInsertImage(row);
+            m_images.insert(m_images.begin() + row, fi);
+            m_fileListModel->endInsertImage();
+        }
+        invalidateRowIndex(row);
+        m_thumbIdleCursor = qMin(m_thumbIdleCursor, row);
     }
-    return fa.size() < fb.size();
+    if (!changed)
+        return;
+
+    // Stay on the current image, or about the same place if it is hidden.
+    const int currentRow = currentPath.isEmpty() ? -1 : indexFromPath(currentPath);
+    const int count = static_cast<int>(m_images.size());
+    m_currentIndex = currentRow >= 0 ? currentRow : count == 0 ? -1 : qBound(0, previousIndex, count - 1);
+    displayCurrentImage();
+    ensurePreloadWindow();
 }
 
+void PhotoTriageWindow::onMetadataReady(quint64 jobId, const QStringList &paths,
+                                        const QList<ExifMetadata> &metadata)
+{
+    if (jobId != m_metadataJobId)
+        return;
+    m_metadataJobRunning = false;
+    for (qsizetype i = 0; i < paths.size() && i < metadata.size(); ++i)
+        m_metadata.insert(paths.at(i), metadata.at(i));
+    // Files listed while the job ran.
+    indexMetadata();
+    settleViewOrder();
+}
 
+void PhotoTriageWindow::onScanFinished(quint64 scanId, int total)
+{
+    if (scanId != m_scanId)
+        return;
+    m_scanning = false;
+    if (total == 0)
+        displayCurrentImage();
+    settleViewOrder();
+    // Changes seen while the folder was still being listed.
+    if (m_rescanPending)
+        m_rescanTimer->start();
+}
 
-void PhotoTriageWindow::loadSourceDirectory(const QString &directory)
+void PhotoTriageWindow::onSourceDirectoryChanged()
 {
-    QDir dir(directory);
-    if (!dir.exists()) {
-        QMessageBox::warning(this, tr("Invalid Directory"), tr("%1 is not a valid directory.").arg(directory));
+    auto own = std::find_if(m_ownChanges.begin(), m_ownChanges.end(),
+                            [](const OwnChange &change) { return !change.seen; });
+    if (own != m_ownChanges.end()) {
+        own->seen = true;
         return;
     }
-    // Collect image files with supported extensions.  Pass all filters at once to
-    // avoid duplicates (e.g. *.jpg and *.jpeg matching the same file).  The
-    // resulting list is sorted lexically by name; we'll sort naturally below.
-    // Supported file extensions.  Include common RAW formats alongside
-    // standard image types.  Use both lowercase and uppercase patterns so
-    // case‑sensitive filesystems are handled.  When adding new RAW types
-    // here ensure the detection logic in ImageLoader/RawLoader matches.
-    const QStringList exts = {
-        "*.jpg", "*.jpeg", "*.png", "*.bmp", "*.gif",
-        "*.tif", "*.tiff", "*.webp", "*.avif",
-        // RAW formats (Sony, Canon, Nikon, Fujifilm, Panasonic, Leica, Olympus, Pentax, Samsung, Adobe, generic)
-        "*.arw", "*.ARW", "*.cr2", "*.CR2", "*.cr3", "*.CR3",
-        "*.nef", "*.NEF", "*.nrw", "*.NRW", "*.raf", "*.RAF",
-        "*.rw2", "*.RW2", "*.rwl", "*.RWL", "*.orf", "*.ORF",
-        "*.pef", "*.PEF", "*.srw", "*.SRW", "*.dng", "*.DNG",
-        "*.raw", "*.RAW"
-    };
-    QFileInfoList fileList = dir.entryInfoList(exts, QDir::Files | QDir::NoSymLinks, QDir::Name);
-
-    // Transfer to std::vector for natural sorting and deduplicate by absolute path
-    std::vector<QFileInfo> files;
-    files.reserve(fileList.size());
-    QSet<QString> seen;
-    for (const QFileInfo &fi : fileList) {
-        const QString abs = fi.absoluteFilePath();
-        if (!seen.contains(abs)) {
-            files.push_back(fi);
-            seen.insert(abs);
+    m_rescanTimer->start();
+}
+
+void PhotoTriageWindow::trackOwnChange(quint64 taskId, int taskState)
+{
+    const auto state = static_cast<FileTaskState>(taskState);
+    if (state == FileTaskState::Running) {
+        OwnChange change;
+        change.taskId = taskId;
+        m_ownChanges.push_back(change);
+        return;
+    }
+    if (state != FileTaskState::Done && state != FileTaskState::Failed)
+        return;
+    auto own = std::find_if(m_ownChanges.begin(), m_ownChanges.end(),
+                            [taskId](const OwnChange &change) { return change.taskId == taskId; });
+    if (own == m_ownChanges.end())
+        return;
+    if (state == FileTaskState::Failed) {
+        // Nothing changed, so whatever was matched to the task was not ours.
+        const bool seen = own->seen;
+        m_ownChanges.erase(own);
+        if (seen)
+            m_rescanTimer->start();
+        return;
+    }
+    // Its notification may still be on the way.
+    own->doneAt = m_ownChangeClock.elapsed();
+    if (!m_ownChangeTimer->isActive())
+        m_ownChangeTimer->start();
+}
+
+void PhotoTriageWindow::expireOwnChanges()
+{
+    const qint64 now = m_ownChangeClock.elapsed();
+    bool unseen = false;
+    bool waiting = false;
+    for (auto it = m_ownChanges.begin(); it != m_ownChanges.end(); ) {
+        if (it->doneAt >= 0 && now - it->doneAt >= RESCAN_DEBOUNCE_MS) {
+            unseen = unseen || !it->seen;
+            it = m_ownChanges.erase(it);
+        } else {
+            waiting = waiting || it->doneAt >= 0;
+            ++it;
         }
     }
-    // std::sort(files.begin(), files.end(), &PhotoTriageWindow::naturalLess);
-    // Pre-tokenize once, then sort on the keys (fast)
-    std::vector<std::pair<QFileInfo, SortKey>> keyed;
-    keyed.reserve(files.size());
-    for (const QFileInfo& fi : files) {
-        SortKey k;
-        k.base = fi.completeBaseName();
-        k.ext  = fi.suffix();
-        buildTokens(k.base, k.tokens);
-        keyed.emplace_back(fi, std::move(k));
+    if (unseen)
+        m_rescanTimer->start();
+    if (waiting)
+        m_ownChangeTimer->start();
+}
+
+void PhotoTriageWindow::startRescan()
+{
+    if (m_sourceDir.isEmpty())
+        return;
+    // One listing at a time; changes that arrive meanwhile are picked up by
+    // another pass once the current one has finished.
+    if (m_scanning || m_rescanning) {
+        m_rescanPending = true;
+        return;
     }
+    m_rescanPending = false;
+    m_rescanning = true;
+    m_rescanFiles.clear();
+    m_restoredDuringRescan.clear();
+    m_rescanId = m_rescanner->start(m_sourceDir);
+}
 
-    std::sort(keyed.begin(), keyed.end(), &naturalLessKeyed);
+void PhotoTriageWindow::onRescanBatch(quint64 scanId, const QFileInfoList &files)
+{
+    if (scanId == m_rescanId)
+        m_rescanFiles.append(files);
+}
 
-    files.clear();
-    files.reserve(keyed.size());
-    for (const auto &pair : keyed) {
-        files.push_back(pair.first);
+void PhotoTriageWindow::onRescanFinished(quint64 scanId, int total)
+{
+    Q_UNUSED(total);
+    if (scanId != m_rescanId)
+        return;
+    m_rescanning = false;
+    const QFileInfoList listed = std::exchange(m_rescanFiles, QFileInfoList());
+
+    QSet<QString> present;
+    present.reserve(listed.size());
+    QHash<QString, size_t> hidden;
+    hidden.reserve(qsizetype(m_filteredOut.size()));
+    for (size_t i = 0; i < m_filteredOut.size(); ++i)
+        hidden.insert(m_filteredOut[i].absoluteFilePath(), i);
+    QFileInfoList added;
+    bool changed = false;
+    bool reindex = false;
+    auto overwritten = [](const QFileInfo &known, const QFileInfo &fi) {
+        return known.size() != fi.size() || known.lastModified() != fi.lastModified();
+    };
+    for (const QFileInfo &fi : listed) {
+        const QString path = fi.absoluteFilePath();
+        present.insert(path);
+        const int row = indexFromPath(path);
+        if (row < 0) {
+            // Files hidden by the filter are known; only their contents
+            // may have changed.
+            auto it = hidden.constFind(path);
+            if (it != hidden.constEnd()) {
+                if (overwritten(m_filteredOut[it.value()], fi)) {
+                    m_filteredOut[it.value()] = fi;
+                    m_metadata.remove(path);
+                    forgetImage(path);
+                    reindex = true;
+                }
+                continue;
+            }
+            // Files queued for a keep/reject move are still in the folder
+            // until the worker gets to them; they must not come back.
+            if (!m_movedAway.contains(path))
+                added.append(fi);
+            continue;
+        }
+        // Overwritten in place (e.g. a re-shot tethered frame): drop every
+        // decoded copy and the indexed metadata so the new contents are
+        // shown and filtered.
+        const QFileInfo &known = m_images.at(row);
+        if (overwritten(known, fi)) {
+            m_images[row] = fi;
+            m_metadata.remove(path);
+            forgetImage(path);
+            m_fileListModel->thumbnailChanged(row);
+            changed = true;
+            reindex = true;
+        }
+    }
+    // A moved-away file that has left the folder has finished moving.
+    for (auto it = m_movedAway.begin(); it != m_movedAway.end(); ) {
+        if (present.contains(*it))
+            ++it;
+        else
+            it = m_movedAway.erase(it);
     }
 
-    m_images = std::move(files);
-    m_currentIndex = m_images.empty() ? -1 : 0;
+    // Remove vanished files in place, bottom up so rows stay valid.  The
+    // listing is a snapshot, so a file restored by undo since, or still
+    // being restored, is kept.
+    const QSet<QString> restored = std::exchange(m_restoredDuringRescan, QSet<QString>());
+    auto vanished = [&](const QString &path) {
+        return !present.contains(path) && !m_restoring.contains(path) && !restored.contains(path);
+    };
+    for (int row = static_cast<int>(m_images.size()) - 1; row >= 0; --row) {
+        const QString path = m_images.at(row).absoluteFilePath();
+        if (!vanished(path))
+            continue;
+        {
+            QScopedValueRollback<bool> guard(m_syncingFileList, true);
+            m_fileListModel->beginRemoveImage(row);
+            m_images.erase(m_images.begin() + row);
+            m_fileListModel->endRemoveImage();
+        }
+        m_rowByPath.remove(path);
+        invalidateRowIndex(row);
+        if (row < m_currentIndex)
+            --m_currentIndex;
+        if (row < m_thumbIdleCursor)
+            --m_thumbIdleCursor;
+        forgetImage(path);
+        changed = true;
+    }
+    if (m_currentIndex >= static_cast<int>(m_images.size()))
+        m_currentIndex = static_cast<int>(m_images.size()) - 1;
+    m_filteredOut.erase(std::remove_if(m_filteredOut.begin(), m_filteredOut.end(),
+                                       [&](const QFileInfo &fi) { return vanished(fi.absoluteFilePath()); }),
+                        m_filteredOut.end());
+    if (reindex)
+        indexMetadata();
+
+    if (!added.isEmpty()) {
+        // Binary-inserted at their natural positions; this also refreshes
+        // the display and the preload window.
+        NaturalSort::sort(added);
+        insertSortedImages(added);
+    } else if (changed) {
+        displayCurrentImage();
+        ensurePreloadWindow();
+    }
 
-    m_sourceDir = directory;
-    // Prepare destination directories (siblings of source)
-    m_keepDir = QDir(directory).filePath("keep");
-    m_discardDir = QDir(directory).filePath("discard");
+    if (m_rescanPending)
+        m_rescanTimer->start();
+}
 
-    // Ensure directories exist
-    QDir().mkpath(m_keepDir);
-    QDir().mkpath(m_discardDir);
+void PhotoTriageWindow::stashMovedImage(const QString &path, const QString &destination)
+{
+    MovedImage moved;
+    moved.destination = destination;
+    moved.image = m_preloaded.peek(path);
+    moved.refinedHalf = m_refined.peek(refinedKey(path, static_cast<int>(DecodePurpose::RefineHalf)));
+    moved.thumbnail = m_thumbnailCache.value(path);
+    if (moved.image.isNull() && moved.thumbnail.isNull())
+        return;
+    m_recentlyMoved.push_back(std::move(moved));
+    if (static_cast<int>(m_recentlyMoved.size()) > RECENTLY_MOVED_IMAGES)
+        m_recentlyMoved.pop_front();
+}
 
-    // Reset state
-    m_preloaded.clear();
-    m_undoStack.clear();
-    m_statusBar->clearMessage();
+bool PhotoTriageWindow::restoreMovedImage(const QString &destination, const QString &path)
+{
+    auto it = std::find_if(m_recentlyMoved.rbegin(), m_recentlyMoved.rend(),
+                           [&destination](const MovedImage &m) { return m.destination == destination; });
+    if (it == m_recentlyMoved.rend())
+        return false;
+    if (!it->image.isNull())
+        m_preloaded.insert(path, it->image);
+    if (!it->refinedHalf.isNull())
+        m_refined.insert(refinedKey(path, static_cast<int>(DecodePurpose::RefineHalf)), it->refinedHalf);
+    if (!it->thumbnail.isNull())
+        m_thumbnailCache.insert(path, it->thumbnail);
+    m_recentlyMoved.erase(std::next(it).base());
+    return true;
+}
 
-    displayCurrentImage();
-    // Begin preloading immediately so the next few images are ready before the user
-    // navigates.  This call will schedule ImageLoader instances via
-    // ensurePreloadWindow().
-    ensurePreloadWindow();
+void PhotoTriageWindow::forgetImage(const QString &path)
+{
+    m_preloaded.remove(path);
+    m_refined.remove(refinedKey(path, static_cast<int>(DecodePurpose::RefineHalf)));
+    m_thumbnailCache.remove(path);
+    m_thumbRequested.remove(path);
+    m_thumbBoosted.remove(path);
+    m_thumbPending.remove(path);
+    m_undecodable.remove(path);
+    // Drop any queued decodes for the file.  Jobs already running are
+    // aborted, or finish and are ignored once the path has left m_images.
+    if (m_decodePool) {
+        m_decodePool->cancel(path, DecodePurpose::Display);
+        m_decodePool->cancel(path, DecodePurpose::Thumbnail);
+        m_decodePool->cancel(path, DecodePurpose::RefineHalf);
+    }
+}
 
-    // Populate the side list with the new set of images.  Building the list
-    // immediately after loading the directory ensures that the thumbnails are
-    // available before the user begins navigating.  Without this call the list
-    // would still show entries from a previous directory.
-    populateFileList();
+bool PhotoTriageWindow::canDecode(const QString &path) const
+{
+    return !m_undecodable.contains(path) && !m_restoring.contains(path);
 }
 
 void PhotoTriageWindow::displayCurrentImage()
 {
     if (m_currentIndex < 0 || m_currentIndex >= static_cast<int>(m_images.size())) {
         m_imageLabel->clear();
-        m_imageLabel->setText(tr("No images."));
+        m_imageLabel->setText(m_scanning ? tr("Scanning folder…")
+                              : m_filteredOut.empty() ? tr("No images.")
+                                                      : tr("No images match the filter."));
         m_statusBar->showMessage(QString());
         // Clear selection in file list when there are no images
-        if (m_fileListWidget) {
-            m_fileListWidget->blockSignals(true);
-            m_fileListWidget->setCurrentRow(-1);
-            m_fileListWidget->blockSignals(false);
-        }
+        syncFileListSelection();
         return;
     }
     const QFileInfo &fi = m_images.at(m_currentIndex);
-    QImage image;
     const QString key = fi.absoluteFilePath();
     // Use preloaded image if available.  Do not remove it from the cache
-    // here; the sliding window in ensurePreloadWindow() manages eviction.  If
-    // the image is not cached, load it synchronously.  Keeping cached
-    // images intact allows rapid back‑and‑forth navigation with minimal
-    // disk I/O.
-    if (m_preloaded.contains(key)) {
-        image = m_preloaded.value(key);
-    } else {
-        // Attempt to synchronously load the image.  We try Qt’s loader first;
-        // if that fails and the file is a RAW, fall back to RawLoader.
-        // This mirrors the logic used in ImageLoader but runs on the UI thread.
-        if (!image.load(fi.filePath())) {
-#ifdef HAVE_LIBRAW
-            // Determine whether the extension suggests a RAW file
-            auto isRawExtension = [](const QString &ext) {
-                static const QSet<QString> rawExts = {
-                    QStringLiteral("arw"), QStringLiteral("cr2"), QStringLiteral("cr3"),
-                    QStringLiteral("nef"), QStringLiteral("nrw"), QStringLiteral("raf"),
-                    QStringLiteral("rw2"), QStringLiteral("rwl"), QStringLiteral("orf"),
-                    QStringLiteral("pef"), QStringLiteral("srw"), QStringLiteral("dng"),
-                    QStringLiteral("raw")
-                };
-                return rawExts.contains(ext.toLower());
-            };
-            const QString ext = fi.suffix();
-            if (isRawExtension(ext)) {
-                QImage rawImg;
-                // Try embedded preview first; if that fails use demosaic (half size).
-                if (RawLoader::loadEmbeddedPreview(fi.filePath(), rawImg) ||
-                    RawLoader::loadDemosaiced(fi.filePath(), rawImg, true)) {
-                    image = rawImg;
-                }
-            }
-#endif
+    // here; ensurePreloadWindow() manages eviction.  Only the first display
+    // of an image counts towards the cache statistics, so re-rendering the
+    // same image (resize, late arrival) does not inflate the hit rate.
+    const bool newTarget = key != m_displayedPath;
+    if (newTarget) {
+        // Refinement work for the image being left is no longer wanted; the
+        // dwell timer restarts for the new one.
+        if (m_decodePool && !m_displayedPath.isEmpty()) {
+            m_decodePool->cancel(m_displayedPath, DecodePurpose::RefineHalf);
         }
+        m_refineTimer->stop();
+        if (ImageLoader::isRawFile(key))
+            m_refineTimer->start();
     }
-    QPixmap pixmap = QPixmap::fromImage(image);
-    if (!pixmap.isNull()) {
-        QPixmap scaled = pixmap.scaled(m_imageLabel->size(), Qt::KeepAspectRatio, Qt::SmoothTransformation);
-        m_imageLabel->setPixmap(scaled);
+    m_displayedPath = key;
+    const QImage image = bestImageFor(key, newTarget);
+    if (!image.isNull()) {
+        m_lastRendered = renderForLabel(key, image);
+        m_imageLabel->setPixmap(m_lastRendered);
         m_imageLabel->setText(QString());
     } else {
-        m_imageLabel->setText(tr("Unable to load image"));
+        // Never decode on the GUI thread.  Request the image from the pool at
+        // top priority and show the upscaled thumbnail (soft, but instantly
+        // recognisable) until onImagePreloaded() swaps in the real image.
+        const bool undecodable = m_undecodable.contains(key);
+        if (m_decodePool && canDecode(key)) {
+            m_decodePool->submit(key, DecodePurpose::Display, 0, displayTargetSize(), m_preloadGeneration);
+        }
+        auto thumb = m_thumbnailCache.constFind(key);
+        if (thumb != m_thumbnailCache.constEnd() && !thumb->isNull()) {
+            // In physical pixels like the decode that replaces it, so it is
+            // as sharp as the thumbnail allows and lands at the same size.
+            m_lastRendered = thumb->scaled(displayTargetSize(), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            m_lastRendered.setDevicePixelRatio(m_imageLabel->devicePixelRatioF());
+            m_imageLabel->setPixmap(m_lastRendered);
+            m_imageLabel->setText(QString());
+        } else {
+            m_lastRendered = QPixmap();
+            m_imageLabel->clear();
+            m_imageLabel->setText(undecodable ? tr("Cannot display this image.") : tr("Loading…"));
+        }
     }
     // Update status bar
-    m_statusBar->showMessage(tr("%1/%2 – %3").arg(m_currentIndex + 1).arg(m_images.size()).arg(fi.fileName()));
+    if (m_filteredOut.empty()) {
+        m_statusBar->showMessage(tr("%1/%2 – %3").arg(m_currentIndex + 1).arg(m_images.size()).arg(fi.fileName()));
+    } else {
+        m_statusBar->showMessage(tr("%1/%2 (%3 filtered out) – %4").arg(m_currentIndex + 1).arg(m_images.size())
+                                     .arg(m_filteredOut.size()).arg(fi.fileName()));
+    }
+    updateCacheStatus();
 
-    // Highlight the current item in the side list.  Blocking signals prevents
-    // triggering onFileListSelectionChanged recursively.
-    if (m_fileListWidget) {
-        m_fileListWidget->blockSignals(true);
-        m_fileListWidget->setCurrentRow(m_currentIndex);
-        m_fileListWidget->scrollToItem(m_fileListWidget->currentItem(), QAbstractItemView::PositionAtCenter);
-        m_fileListWidget->blockSignals(false);
+    // Highlight the current item in the side list.
+    syncFileListSelection();
+}
+
+void PhotoTriageWindow::syncFileListSelection()
+{
+    if (!m_fileListView)
+        return;
+    // The guard (rather than blocking the selection model's signals) keeps
+    // the view itself informed so the highlight repaints.
+    QScopedValueRollback<bool> guard(m_syncingFileList, true);
+    QItemSelectionModel *selection = m_fileListView->selectionModel();
+    if (m_currentIndex < 0 || m_currentIndex >= static_cast<int>(m_images.size())) {
+        selection->clear();
+        return;
     }
+    const QModelIndex index = m_fileListModel->index(m_currentIndex);
+    selection->setCurrentIndex(index, QItemSelectionModel::ClearAndSelect);
+    m_fileListView->scrollTo(index, QAbstractItemView::PositionAtCenter);
 }
 
 int PhotoTriageWindow::indexFromPath(const QString &path) const
 {
-    // Linear scan (O(N)) – perfectly fine for a few thousand images.
-    for (int i = 0; i < static_cast<int>(m_images.size()); ++i)
-        if (m_images[i].absoluteFilePath() == path)
-            return i;
-    return -1;          // not found (shouldn’t normally happen)
+    // Bring the rows that shifted since the last lookup up to date.  After a
+    // move or undo only the rows below the change are touched, once, no
+    // matter how many lookups follow.
+    const int count = static_cast<int>(m_images.size());
+    for (int i = m_rowIndexDirtyFrom; i < count; ++i)
+        m_rowByPath.insert(m_images[i].absoluteFilePath(), i);
+    m_rowIndexDirtyFrom = count;
+
+    auto it = m_rowByPath.constFind(path);
+    if (it == m_rowByPath.constEnd())
+        return -1;      // not found (e.g. a result for a file moved away)
+    const int row = it.value();
+    // Guard against a stale entry for a path that left the list.
+    if (row >= count || m_images[row].absoluteFilePath() != path)
+        return -1;
+    return row;
+}
+
+void PhotoTriageWindow::invalidateRowIndex(int row)
+{
+    m_rowIndexDirtyFrom = qMin(m_rowIndexDirtyFrom, qMax(0, row));
 }
 
+QByteArray PhotoTriageWindow::sortKey(const QFileInfo &file)
+{
+    const QString path = file.absoluteFilePath();
+    auto it = m_sortKeys.constFind(path);
+    if (it != m_sortKeys.constEnd())
+        return it.value();
+    const QByteArray key = NaturalSort::key(file);
+    m_sortKeys.insert(path, key);
+    return key;
+}
+
+
+QSize PhotoTriageWindow::displayTargetSize() const
+{
+    // Physical pixels, so images stay sharp on high-DPI screens.
+    const qreal dpr = m_imageLabel->devicePixelRatioF();
+    const QSize logical = m_imageLabel->size();
+    return QSize(qMax(1, qRound(logical.width() * dpr)), qMax(1, qRound(logical.height() * dpr)));
+}
+
+bool PhotoTriageWindow::fitsDisplay(const QImage &image) const
+{
+    const QSize fitted = image.size().scaled(displayTargetSize(), Qt::KeepAspectRatio);
+    return qAbs(fitted.width() - image.width()) <= 1 && qAbs(fitted.height() - image.height()) <= 1;
+}
+
+bool PhotoTriageWindow::coversDisplay(const QImage &image) const
+{
+    const QSize fitted = image.size().scaled(displayTargetSize(), Qt::KeepAspectRatio);
+    return image.width() + 1 >= fitted.width() && image.height() + 1 >= fitted.height();
+}
+
+QPixmap PhotoTriageWindow::renderForLabel(const QString &path, const QImage &image)
+{
+    const QSize target = displayTargetSize();
+    // QImage::cacheKey() tells the preview and refinement stages apart.
+    const QString key = QStringLiteral("%1|%2x%3|%4").arg(path)
+                            .arg(target.width()).arg(target.height()).arg(image.cacheKey());
+    if (QPixmap *cached = m_renderCache.object(key))
+        return *cached;
+
+    // Decoded images normally arrive already fitted to the label, in which
+    // case this is a plain conversion; only images decoded for an older
+    // label size are rescaled here (down, after the label shrank).
+    QPixmap pixmap;
+    if (fitsDisplay(image)) {
+        pixmap = QPixmap::fromImage(image);
+    } else {
+        const QSize fitted = image.size().scaled(target, Qt::KeepAspectRatio);
+        pixmap = QPixmap::fromImage(image.scaled(fitted, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+    }
+    pixmap.setDevicePixelRatio(m_imageLabel->devicePixelRatioF());
+    const qint64 costKB = qint64(pixmap.width()) * pixmap.height() * 4 / 1024;
+    m_renderCache.insert(key, new QPixmap(pixmap), int(qBound<qint64>(1, costKB, RENDER_CACHE_KB)));
+    return pixmap;
+}
+
+QImage PhotoTriageWindow::bestImageFor(const QString &path, bool recordLookup)
+{
+    QImage image = recordLookup ? m_preloaded.find(path) : m_preloaded.peek(path);
+    // Prefer the refinement if one is already decoded for this RAW.
+    const QImage half = m_refined.peek(refinedKey(path, static_cast<int>(DecodePurpose::RefineHalf)));
+    if (!half.isNull())
+        return half;
+    return image;
+}
+
+int PhotoTriageWindow::preloadRank(int row) const
+{
+    if (row < 0 || m_currentIndex < 0)
+        return -1;
+    const int d = row - m_currentIndex;
+    return d >= 0 ? d : -2 * d;
+}
 
 void PhotoTriageWindow::ensurePreloadWindow()
 {
     if (m_currentIndex < 0 || m_currentIndex >= static_cast<int>(m_images.size())) {
         return;
     }
-    // Maintain a sliding window of preloaded images around the current index.  The
-    // cache retains images within [currentIndex - PRELOAD_BACK_DEPTH, currentIndex + PRELOAD_DEPTH].
-    for (auto it = m_preloaded.begin(); it != m_preloaded.end(); ) {
-        const QString path = it.key();
-        int idx = indexFromPath(path);
-        // Keep images within the window; evict those too far behind or ahead
-        if (idx < m_currentIndex - PRELOAD_BACK_DEPTH || idx > m_currentIndex + PRELOAD_DEPTH) {
-            it = m_preloaded.erase(it);
-        } else {
-            ++it;
-        }
+    // The cursor may have moved, so re-rank resident images and evict the
+    // furthest ones if the cache is over budget.
+    m_preloaded.trim();
+
+    // Fill outward from the current index in preloadRank() order (two rows
+    // ahead for every row behind) until the projected footprint reaches the
+    // budget.  Resident images count with their real size; the rest are
+    // estimated from the average decoded size so far.  Filling only to 90%
+    // of the budget leaves headroom so an estimate that runs low does not
+    // immediately evict an image that was just decoded.
+    const qint64 fillBudget = m_preloaded.budget() / 10 * 9;
+    const qint64 average = m_preloaded.averageImageBytes();
+    const qint64 estimate = average > 0 ? average : qint64(32) * 1024 * 1024;
+    auto footprint = [&](int row) {
+        const QString path = m_images.at(row).absoluteFilePath();
+        const qint64 bytes = m_preloaded.sizeOf(path);
+        return bytes >= 0 ? bytes : canDecode(path) ? estimate : 0;
+    };
+
+    // Every job still wanted is tagged with a fresh generation; jobs already
+    // queued are re-prioritised in place rather than duplicated.
+    // Neighbours are decoded directly at the size they will be shown at, so
+    // the cache holds display-ready images rather than full resolutions.
+    const QSize targetSize = displayTargetSize();
+    const quint64 generation = ++m_preloadGeneration;
+    const int count = static_cast<int>(m_images.size());
+    qint64 projected = footprint(m_currentIndex);
+    // The current image always comes first.
+    const QString currentKey = m_images.at(m_currentIndex).absoluteFilePath();
+    const QImage currentCached = m_preloaded.peek(currentKey);
+    if ((currentCached.isNull() || !coversDisplay(currentCached)) && canDecode(currentKey))
+        m_decodePool->submit(currentKey, DecodePurpose::Display, 0, targetSize, generation);
+    int ahead = 1;
+    int behind = 1;
+    while (true) {
+        const bool canAhead = ahead <= MAX_PRELOAD_AHEAD && m_currentIndex + ahead < count;
+        const bool canBehind = behind <= MAX_PRELOAD_BEHIND && m_currentIndex - behind >= 0;
+        if (!canAhead && !canBehind)
+            break;
+        const int row = (canAhead && (!canBehind || ahead <= 2 * behind))
+                            ? m_currentIndex + ahead++
+                            : m_currentIndex - behind++;
+        projected += footprint(row);
+        if (projected > fillBudget)
+            break;
+        // Images decoded for a smaller label are fetched again; the old copy
+        // stays in the cache until the replacement arrives.  Larger ones
+        // are scaled down when shown.
+        const QString key = m_images.at(row).absoluteFilePath();
+        const QImage cached = m_preloaded.peek(key);
+        if ((!cached.isNull() && coversDisplay(cached)) || !canDecode(key)) continue;
+        m_decodePool->submit(key, DecodePurpose::Display, preloadRank(row), targetSize, generation);
+    }
+    // Anything left over from an earlier position (e.g. after a far jump in
+    // the file list) is no longer wanted: drop it before it starts and
+    // abort it if it is already decoding.
+    m_decodePool->dropStale(DecodePurpose::Display, generation);
+}
+
+void PhotoTriageWindow::updateCacheStatus()
+{
+    if (!m_cacheStatusLabel)
+        return;
+    const qint64 mb = 1024 * 1024;
+    m_cacheStatusLabel->setText(tr("Cache %1/%2 MB · %3% hits")
+                                    .arg(m_preloaded.residentBytes() / mb)
+                                    .arg(m_preloaded.budget() / mb)
+                                    .arg(qRound(m_preloaded.hitRate() * 100.0)));
+    // Decode times per format, for telling a slow codec from a slow disk.
+    const QString decodes = FormatRegistry::summary();
+    QString tip = tr("Preload cache: resident memory / budget and hit rate. Press M to change the budget.");
+    if (!decodes.isEmpty())
+        tip += QStringLiteral("\n\n") + tr("Decodes:") + QLatin1Char('\n') + decodes;
+    m_cacheStatusLabel->setToolTip(tip);
+}
+
+void PhotoTriageWindow::chooseCacheBudget()
+{
+    bool ok = false;
+    const int current = static_cast<int>(m_preloaded.budget() / (1024 * 1024));
+    const int budgetMB = QInputDialog::getInt(this, tr("Preload Memory"),
+                                              tr("Memory budget for preloaded images (MB):"),
+                                              current, 64, 65536, 64, &ok);
+    if (!ok)
+        return;
+    QSettings().setValue(QStringLiteral("cache/budgetMB"), budgetMB);
+    m_preloaded.setBudget(qint64(budgetMB) * 1024 * 1024);
+    m_refined.setBudget(m_preloaded.budget() / 4);
+    ensurePreloadWindow();
+    updateCacheStatus();
+}
+
+
+void PhotoTriageWindow::onImageDecoded(const QString &path, int purpose, const QImage &image)
+{
+    switch (static_cast<DecodePurpose>(purpose)) {
+    case DecodePurpose::Thumbnail:
+        onThumbnailLoaded(path, image);
+        break;
+    case DecodePurpose::RefineHalf:
+        onImageRefined(path, purpose, image);
+        break;
+    default:
+        onImagePreloaded(path, image);
+        break;
+    }
+}
+
+QString PhotoTriageWindow::refinedKey(const QString &path, int purpose)
+{
+    return path + QLatin1Char('|') + QString::number(purpose);
+}
+
+void PhotoTriageWindow::onRefineTimeout()
+{
+    if (!m_decodePool || m_currentIndex < 0 || m_currentIndex >= static_cast<int>(m_images.size()))
+        return;
+    const QString path = m_images.at(m_currentIndex).absoluteFilePath();
+    if (!ImageLoader::isRawFile(path))
+        return;
+    // Unless it is already cached at (at least) the current label size.
+    const QImage half = m_refined.peek(refinedKey(path, static_cast<int>(DecodePurpose::RefineHalf)));
+    if (half.isNull() || !coversDisplay(half))
+        m_decodePool->submit(path, DecodePurpose::RefineHalf, 0, displayTargetSize());
+}
+
+void PhotoTriageWindow::onImageRefined(const QString &path, int purpose, const QImage &image)
+{
+    // LibRaw could not demosaic it; the preview stays.
+    if (image.isNull() || indexFromPath(path) < 0)
+        return;
+    m_refined.insert(refinedKey(path, purpose), image);
+    const bool isCurrent = m_currentIndex >= 0 && m_currentIndex < static_cast<int>(m_images.size())
+                           && m_images.at(m_currentIndex).absoluteFilePath() == path;
+    if (isCurrent)
+        displayCurrentImage();
+}
+
+void PhotoTriageWindow::onImagePreloaded(const QString &path, const QImage &image)
+{
+    // Store preloaded image in cache keyed by its absolute path.  Results for
+    // files that have left the list since the job was queued are dropped.
+    if (indexFromPath(path) < 0)
+        return;
+    const bool isCurrent = m_currentIndex >= 0 && m_currentIndex < static_cast<int>(m_images.size())
+                           && m_images.at(m_currentIndex).absoluteFilePath() == path;
+    if (image.isNull()) {
+        // Not asked for again until the file changes.
+        m_undecodable.insert(path);
+        if (isCurrent)
+            displayCurrentImage();
+        updateCacheStatus();
+        return;
     }
-    // Preload ahead within the forward window
-    for (int i = m_currentIndex + 1; i <= m_currentIndex + PRELOAD_DEPTH && i < m_images.size(); ++i) {
-        const QString key = m_images.at(i).absoluteFilePath();
-        if (m_preloaded.contains(key) || m_loading.contains(i)) continue;
-        ImageLoader *ldr = new ImageLoader(i, key, this);
-        connect(ldr, &ImageLoader::loaded,
-                this,  &PhotoTriageWindow::onImagePreloaded,
-                Qt::QueuedConnection);
-        connect(ldr, &QThread::finished, ldr, &QObject::deleteLater);
-        m_loading.insert(i);
-        ldr->start();
-    }
-    // Optionally preload a small number of images behind the current one to
-    // facilitate smooth backward navigation.  Only start loaders for those
-    // indices if not already cached or loading.
-    for (int i = m_currentIndex - 1; i >= m_currentIndex - PRELOAD_BACK_DEPTH && i >= 0; --i) {
-        const QString key = m_images.at(i).absoluteFilePath();
-        if (m_preloaded.contains(key) || m_loading.contains(i)) continue;
-        ImageLoader *ldr = new ImageLoader(i, key, this);
-        connect(ldr, &ImageLoader::loaded,
-                this,  &PhotoTriageWindow::onImagePreloaded,
-                Qt::QueuedConnection);
-        connect(ldr, &QThread::finished, ldr, &QObject::deleteLater);
-        m_loading.insert(i);
-        ldr->start();
-    }
-}
-
-
-void PhotoTriageWindow::onImagePreloaded(int index, const QString &path, const QImage &image)
-{
-    // Store preloaded image in cache keyed by its absolute path.
     m_preloaded.insert(path, image);
-    // Remove from loading set by index if present
-    m_loading.remove(index);
+    // Swap in the full image if the user is still looking at a placeholder.
+    if (isCurrent) {
+        displayCurrentImage();
+    }
     ensurePreloadWindow();
+    updateCacheStatus();
 }
 
-// Initiate asynchronous thumbnail loading for list items that do not yet
-// have cached thumbnails.  Uses ImageLoader with a small target size to
-// reduce decoding overhead.  Loading is performed off the main thread and
-// results are delivered via onThumbnailLoaded().
-void PhotoTriageWindow::startThumbnailLoaders()
+// Record a thumbnail request from the list model.  data() is called while
+// the view paints, so the actual lookup is deferred to scheduleThumbnails()
+// on the next event loop pass.
+void PhotoTriageWindow::requestThumbnail(int row)
 {
-    // Do not attempt to load thumbnails if the list is empty or widget missing
-    if (!m_fileListWidget)
+    if (row < 0 || row >= static_cast<int>(m_images.size()))
         return;
-    // Build the pending queue of indices requiring thumbnail load.  Only
-    // enqueue items without a cached thumbnail and not already loading.
-    m_thumbPending.clear();
+    const QString path = m_images.at(row).absoluteFilePath();
+    if (m_thumbBoosted.contains(path))
+        return;
+    m_thumbPending.insert(path);
+    m_thumbRequestTimer->start();
+}
+
+bool PhotoTriageWindow::requestThumbnailAt(int row, int priority)
+{
+    const QFileInfo &fi = m_images.at(row);
+    const QString path = fi.absoluteFilePath();
+    if (m_thumbnailCache.contains(path) || !canDecode(path))
+        return false;
+    // Thumbnails persisted by an earlier session are pulled straight from
+    // the store (no decoding) the first time the row is asked for.
+    if (!m_thumbRequested.contains(path)) {
+        m_thumbRequested.insert(path);
+        QImage stored;
+        if (m_thumbStore && m_thumbStore->find(path, fi.size(),
+                                               fi.lastModified().toMSecsSinceEpoch(), stored)) {
+            m_thumbnailCache.insert(path, QPixmap::fromImage(stored));
+            m_fileListModel->thumbnailChanged(row);
+            return false;
+        }
+    }
+    // Queue the decode, or move the queued job to the new priority band.
+    if (!m_decodePool)
+        return false;
+    m_decodePool->submit(path, DecodePurpose::Thumbnail, priority, QSize(60, 60));
+    return true;
+}
+
+// Re-rank thumbnail work around the file list viewport.  Rows on screen are
+// queued first, top to bottom, then the rows within THUMB_NEAR_PAGES pages
+// above and below by distance from the screen.  Rows that were boosted by an
+// earlier pass but are now out of range drop back to idle priority, so the
+// cost of a pass is bounded by the size of the two windows.
+void PhotoTriageWindow::scheduleThumbnails()
+{
+    const QSet<QString> pending = std::exchange(m_thumbPending, QSet<QString>());
     const int count = static_cast<int>(m_images.size());
-    for (int i = 0; i < count; ++i) {
-        const QString path = m_images.at(i).absoluteFilePath();
-        if (m_thumbnailCache.contains(path))
-            continue;
-        if (m_thumbLoadingPaths.contains(path))
-            continue;
-        m_thumbPending.enqueue(i);
+    if (!m_fileListView || count == 0)
+        return;
+
+    // An invalid top index means the view has not been laid out yet; the
+    // rows it paints afterwards arrive through requestThumbnail().
+    const QRect viewport = m_fileListView->viewport()->rect();
+    const QModelIndex top = m_fileListView->indexAt(viewport.topLeft());
+    const QModelIndex bottom = m_fileListView->indexAt(viewport.bottomLeft());
+    const int first = top.isValid() ? top.row() : 0;
+    const int last = !top.isValid() ? -1 : bottom.isValid() ? bottom.row() : count - 1;
+    const int page = qMax(1, last - first + 1);
+    const int nearFirst = qMax(0, first - THUMB_NEAR_PAGES * page);
+    const int nearLast = qMin(count - 1, last + THUMB_NEAR_PAGES * page);
+
+    QSet<QString> boosted;
+    auto boost = [&](int row, int priority) {
+        if (requestThumbnailAt(row, priority))
+            boosted.insert(m_images.at(row).absoluteFilePath());
+    };
+    for (int row = first; row <= last; ++row)
+        boost(row, THUMB_PRIORITY_BASE + (row - first));
+    if (last >= first) {
+        for (int d = 1; first - d >= nearFirst || last + d <= nearLast; ++d) {
+            if (last + d <= nearLast)
+                boost(last + d, THUMB_NEAR_PRIORITY_BASE + d);
+            if (first - d >= nearFirst)
+                boost(first - d, THUMB_NEAR_PRIORITY_BASE + d);
+        }
     }
-    // Immediately start up to MAX_THUMB_CONCURRENCY loaders.  Remaining tasks
-    // will be launched as earlier loads complete.  If the pending queue is
-    // empty, this call has no effect.
-    startNextThumbnailLoader();
+    // Rows painted since the last pass are on screen by definition.
+    for (const QString &path : pending) {
+        const int row = indexFromPath(path);
+        if (row >= 0 && !boosted.contains(path))
+            boost(row, THUMB_PRIORITY_BASE + qMax(0, row - first));
+    }
+
+    // Whatever scrolled out of range and is still queued goes back to the
+    // idle band.
+    if (m_decodePool) {
+        for (const QString &path : std::as_const(m_thumbBoosted)) {
+            if (boosted.contains(path) || m_thumbnailCache.contains(path))
+                continue;
+            const int row = indexFromPath(path);
+            if (row >= 0)
+                m_decodePool->submit(path, DecodePurpose::Thumbnail, THUMB_IDLE_PRIORITY_BASE + row, QSize(60, 60));
+        }
+    }
+    m_thumbBoosted = std::move(boosted);
+
+    if (m_thumbIdleCursor < count && !m_thumbIdleTimer->isActive())
+        m_thumbIdleTimer->start();
 }
 
-void PhotoTriageWindow::startNextThumbnailLoader()
+// Walk the folder in order and queue decodes for the thumbnails nobody has
+// asked for yet, a batch per timer tick so the GUI thread stays responsive.
+// Rows the persistent store already covers are skipped: pulling them in
+// once they scroll into view costs no decoding.
+void PhotoTriageWindow::queueIdleThumbnails()
 {
-    // Launch new thumbnail loader(s) until we reach the concurrency limit or
-    // run out of pending items.  Using a loop here allows us to catch up
-    // quickly when multiple loads finish in rapid succession.
-    while (m_thumbLoadingPaths.size() < MAX_THUMB_CONCURRENCY && !m_thumbPending.isEmpty()) {
-        int index = m_thumbPending.dequeue();
-        if (index < 0 || index >= static_cast<int>(m_images.size()))
+    if (!m_decodePool)
+        return;
+    const int count = static_cast<int>(m_images.size());
+    const int end = qMin(count, m_thumbIdleCursor + THUMB_IDLE_BATCH);
+    for (; m_thumbIdleCursor < end; ++m_thumbIdleCursor) {
+        const QFileInfo &fi = m_images.at(m_thumbIdleCursor);
+        const QString path = fi.absoluteFilePath();
+        if (m_thumbRequested.contains(path) || m_thumbnailCache.contains(path) || !canDecode(path))
             continue;
-        const QString path = m_images.at(index).absoluteFilePath();
-        // Skip if already cached or loading
-        if (m_thumbnailCache.contains(path) || m_thumbLoadingPaths.contains(path))
+        if (m_thumbStore && m_thumbStore->contains(path, fi.size(), fi.lastModified().toMSecsSinceEpoch()))
             continue;
-        // Launch loader
-        ImageLoader *ldr = new ImageLoader(index, path, this, QSize(60, 60));
-        connect(ldr, &ImageLoader::loaded,
-                this, &PhotoTriageWindow::onThumbnailLoaded,
-                Qt::QueuedConnection);
-        connect(ldr, &QThread::finished, ldr, &QObject::deleteLater);
-        m_thumbLoadingPaths.insert(path);
-        ldr->start();
+        m_thumbRequested.insert(path);
+        m_decodePool->submit(path, DecodePurpose::Thumbnail,
+                             THUMB_IDLE_PRIORITY_BASE + m_thumbIdleCursor, QSize(60, 60));
     }
+    if (m_thumbIdleCursor < count)
+        m_thumbIdleTimer->start();
 }
 
 // Handle the completion of a thumbnail load.  Save the pixmap to the cache
-// and update the file list item if it still exists.  Remove the index from
-// the loading set.  The index parameter corresponds to the row in
-// m_images at load time; if the list has changed since launch, the
-// thumbnail may need to be discarded.
-void PhotoTriageWindow::onThumbnailLoaded(int index, const QString &path, const QImage &image)
-{
-    Q_UNUSED(index);
-    // Remove the path from the loading set.  This ensures that future
-    // requests for this thumbnail can proceed if the row shifts.
-    m_thumbLoadingPaths.remove(path);
+// and repaint the file list row if it still exists.  Rows may have shifted
+// since the job was queued, so the row is located by path.
+void PhotoTriageWindow::onThumbnailLoaded(const QString &path, const QImage &image)
+{
     // Cache the pixmap if valid
     QPixmap pixmap = QPixmap::fromImage(image);
     if (!pixmap.isNull()) {
         m_thumbnailCache.insert(path, pixmap);
     }
+    m_thumbBoosted.remove(path);
     // Determine the current row of this path.  Rows may shift due to
-    // keep/reject/undo operations.  If found, update the icon on the list
-    // item.  Use a generic file icon if the pixmap is null.
+    // keep/reject/undo operations.  The model keeps showing the generic file
+    // icon if the pixmap is null, and a listed file that failed to decode is
+    // not asked for again until it changes.
     int row = indexFromPath(path);
-    if (row >= 0 && row < m_fileListWidget->count()) {
-        QListWidgetItem *item = m_fileListWidget->item(row);
-        if (item) {
-            if (!pixmap.isNull()) {
-                item->setIcon(QIcon(pixmap));
-            }
-        }
+    if (row >= 0 && pixmap.isNull())
+        m_undecodable.insert(path);
+    // Persist the thumbnail so the next session can skip decoding it.  Only
+    // files still in the list are stored, keyed by their current size/mtime.
+    if (row >= 0 && m_thumbStore && !image.isNull()) {
+        const QFileInfo &fi = m_images.at(row);
+        m_thumbStore->insert(path, fi.size(), fi.lastModified().toMSecsSinceEpoch(), image);
+    }
+    if (row >= 0 && !pixmap.isNull()) {
+        m_fileListModel->thumbnailChanged(row);
     }
-    // Launch the next thumbnail loader from the pending queue, if any
-    startNextThumbnailLoader();
 }
 
 void PhotoTriageWindow::performMove(const QString &action)
@@ -680,88 +1736,120 @@ void PhotoTriageWindow::performMove(const QString &action)
     } else {
         return;
     }
-    QDir destDir(destDirPath);
-    if (!destDir.exists()) {
-        destDir.mkpath(".");
-    }
-    QString destPath = destDir.filePath(fi.fileName());
-    // Ensure unique filename
-    if (QFileInfo::exists(destPath)) {
-        QString stem = fi.completeBaseName();
-        QString suffix = fi.suffix();
-        int counter = 1;
-        QString candidate;
-        do {
-            candidate = destDir.filePath(QStringLiteral("%1_%2.%3").arg(stem).arg(counter).arg(suffix));
-            counter++;
-        } while (QFileInfo::exists(candidate));
-        destPath = candidate;
-    }
+    // Ensure a unique filename.  The name index answers from memory; the
+    // folders were created when the source folder was opened.
+    const QString destPath = QDir(destDirPath).filePath(m_destNames.reserve(destDirPath, fi.fileName()));
     // Asynchronously move file using the background worker
+    // The decision is journaled first; the worker holds the move until the
+    // record is on disk.
     FileTask task;
     task.source = fi.filePath();
     task.destination = destPath;
+    task.journalId = MoveJournal::newMoveId();
+    MoveJournal::Record record;
+    record.type = MoveJournal::Move;
+    record.moveId = task.journalId;
+    record.index = m_currentIndex;
+    record.source = task.source;
+    record.destination = task.destination;
+    record.size = fi.size();
+    record.modified = fi.lastModified().toMSecsSinceEpoch();
+    task.journalSequence = m_journal->append(record);
+    quint64 taskId = 0;
     if (m_fileWorker) {
-        m_fileWorker->enqueue(task);
+        taskId = m_fileWorker->enqueue(task);
     }
     // Record undo info
     MoveAction actionInfo;
     actionInfo.originalPath = fi.filePath();
     actionInfo.destinationPath = destPath;
     actionInfo.index = m_currentIndex;
-    m_undoStack.push_back(actionInfo);
-    if (static_cast<int>(m_undoStack.size()) > MAX_UNDO) {
-        m_undoStack.pop_front();
-    }
-    // Remove from list
+    actionInfo.taskId = taskId;
+    actionInfo.journalId = task.journalId;
+    actionInfo.state = static_cast<int>(FileTaskState::Pending);
+    m_undoStack.push(actionInfo);
+    // Remove from list.  The model announces a single row removal; the
+    // guard stops the view's automatic re-selection of a neighbouring row
+    // from being taken as user navigation.
     int removedIndex = m_currentIndex;
-    m_images.erase(m_images.begin() + removedIndex);
+    {
+        QScopedValueRollback<bool> guard(m_syncingFileList, true);
+        m_fileListModel->beginRemoveImage(removedIndex);
+        m_images.erase(m_images.begin() + removedIndex);
+        m_fileListModel->endRemoveImage();
+    }
+    m_rowByPath.remove(fi.absoluteFilePath());
+    invalidateRowIndex(removedIndex);
     // Adjust index to show next image
     if (m_currentIndex >= static_cast<int>(m_images.size())) {
         m_currentIndex = static_cast<int>(m_images.size()) - 1;
     }
-    // Remove the cache entry for the file that is being removed
+    // Remove the cache entries and pending decodes for the file that is
+    // being removed, and keep the folder watcher from re-adding it while
+    // the move is still queued.
     const QString removedKey = fi.absoluteFilePath();
-    m_preloaded.remove(removedKey);
-    // Remove the thumbnail cache entry as well and reset thumbnail loading
-    m_thumbnailCache.remove(removedKey);
-    // Update the file list widget: remove the corresponding item instead of
-    // rebuilding the entire list.  This keeps UI interactions snappy by
-    // avoiding unnecessary iterations.  Guard against null pointer just in case.
-
-    // if (m_fileListWidget) {
-    //     QListWidgetItem *item = m_fileListWidget->takeItem(removedIndex);
-    //     delete item;
-    //     // Select the new current index after removal
-    //     if (m_currentIndex >= 0) {
-
-    //         m_fileListWidget->setCurrentRow(m_currentIndex);
-
-    //     }
-    //     m_fileListWidget->setCurrentRow(m_currentIndex);
-    // }
-    if (m_fileListWidget) {
-            m_fileListWidget->blockSignals(true);
-            QListWidgetItem *item = m_fileListWidget->takeItem(removedIndex);
-            delete item;
-            if (m_currentIndex >= 0) {
-                    m_fileListWidget->setCurrentRow(m_currentIndex);
-                }
-            m_fileListWidget->blockSignals(false);
-        }
-
+    stashMovedImage(removedKey, destPath);
+    forgetImage(removedKey);
+    m_movedAway.insert(removedKey);
+    if (removedIndex < m_thumbIdleCursor)
+        --m_thumbIdleCursor;
 
     displayCurrentImage();
     ensurePreloadWindow();
-    // Remove the removed key from the set of currently loading thumbnails if
-    // present.  We do not clear the entire loading state because other
-    // thumbnails may still be loading and can continue uninterrupted.  When
-    // their loads finish they will be ignored if their path no longer exists
-    // in m_images.
-    m_thumbLoadingPaths.remove(removedKey);
-    // Queue loading of thumbnails for any images that now lack previews.
-    startThumbnailLoaders();
-    // preloadNext();
+}
+
+void PhotoTriageWindow::onMoveStateChanged(quint64 taskId, int state, const QString &source,
+                                           const QString &destination, const QString &error)
+{
+    trackOwnChange(taskId, state);
+    auto undoing = m_undoing.find(taskId);
+    if (undoing != m_undoing.end()) {
+        onUndoStateChanged(undoing, state, error);
+        return;
+    }
+    // Recent moves complete first, so search from the top of the stack.
+    const qsizetype position = m_undoStack.findTask(taskId);
+    if (position >= 0)
+        m_undoStack.setState(position, state);
+    if (static_cast<FileTaskState>(state) == FileTaskState::Done) {
+        // The file has left the folder.  A listing under way may have been
+        // taken before it did, so it is left to that listing to notice.
+        if (!m_scanning && !m_rescanning)
+            m_movedAway.remove(QFileInfo(source).absoluteFilePath());
+        // The reserved name was taken on disk after all; the worker moved
+        // the file under the next free one.
+        if (position >= 0) {
+            const QString reserved = m_undoStack.at(position).destinationPath;
+            if (reserved != destination) {
+                for (MovedImage &moved : m_recentlyMoved) {
+                    if (moved.destination == reserved)
+                        moved.destination = destination;
+                }
+                m_undoStack.setDestination(position, destination);
+                const QFileInfo dest(destination);
+                m_destNames.insert(dest.absolutePath(), dest.fileName());
+            }
+        }
+        // Undos enqueued from here on carry the final name themselves.
+        if (m_fileWorker)
+            m_fileWorker->acknowledge(taskId);
+        return;
+    }
+    if (static_cast<FileTaskState>(state) != FileTaskState::Failed)
+        return;
+    const QFileInfo dest(destination);
+    m_destNames.release(dest.absolutePath(), dest.fileName());
+    // The row comes back with the rescan; have its pixels ready for it.
+    restoreMovedImage(destination, QFileInfo(source).absoluteFilePath());
+    m_statusBar->showMessage(tr("Could not move %1 to %2: %3")
+                                 .arg(QFileInfo(source).fileName(), QFileInfo(destination).absolutePath(), error),
+                             8000);
+    // The move never happened, so there is nothing to undo.  Let the folder
+    // watcher's diff bring the file back at its sorted position.
+    if (position >= 0)
+        m_undoStack.erase(position);
+    m_movedAway.remove(QFileInfo(source).absoluteFilePath());
+    m_rescanTimer->start();
 }
 
 void PhotoTriageWindow::handleMoveKeep()
@@ -774,77 +1862,152 @@ void PhotoTriageWindow::handleMoveReject()
     performMove(QStringLiteral("discard"));
 }
 
+void PhotoTriageWindow::onUndoStateChanged(QHash<quint64, PendingUndo>::iterator undoing, int taskState,
+                                           const QString &error)
+{
+    const auto state = static_cast<FileTaskState>(taskState);
+    if (state != FileTaskState::Done && state != FileTaskState::Failed)
+        return;
+    const MoveAction action = undoing->action;
+    const bool restoredPixels = undoing->restoredPixels;
+    m_undoing.erase(undoing);
+    const QString path = QFileInfo(action.originalPath).absoluteFilePath();
+    m_restoring.remove(path);
+    if (m_rescanning && state == FileTaskState::Done)
+        m_restoredDuringRescan.insert(path);
+    const int row = indexFromPath(path);
+    if (state == FileTaskState::Done) {
+        const QFileInfo dest(action.destinationPath);
+        m_destNames.release(dest.absolutePath(), dest.fileName());
+        if (row < 0)
+            return;     // replayed from the journal; the folder watcher lists it
+        // The row was put back before the file arrived, and decodes for it
+        // were held back until now.  Without the pixels stashed at move
+        // time, make sure nothing stale is left and decode it afresh.
+        m_images[row] = QFileInfo(path);
+        if (!restoredPixels)
+            forgetImage(path);
+        if (!m_thumbnailCache.contains(path)) {
+            m_thumbRequested.remove(path);
+            m_thumbIdleCursor = qMin(m_thumbIdleCursor, row);
+            m_fileListModel->thumbnailChanged(row);
+            m_thumbRequestTimer->start();
+        }
+        if (row == m_currentIndex)
+            displayCurrentImage();
+        ensurePreloadWindow();
+        return;
+    }
+
+    m_statusBar->showMessage(tr("Could not restore %1 to %2: %3")
+                                 .arg(QFileInfo(action.destinationPath).fileName(),
+                                      QFileInfo(action.originalPath).absolutePath(), error),
+                             8000);
+    // The file is still moved: take the row out again and make the move
+    // undoable once more.
+    if (row >= 0) {
+        {
+            QScopedValueRollback<bool> guard(m_syncingFileList, true);
+            m_fileListModel->beginRemoveImage(row);
+            m_images.erase(m_images.begin() + row);
+            m_fileListModel->endRemoveImage();
+        }
+        m_rowByPath.remove(path);
+        invalidateRowIndex(row);
+        if (row < m_currentIndex || m_currentIndex >= static_cast<int>(m_images.size()))
+            --m_currentIndex;
+        if (row < m_thumbIdleCursor)
+            --m_thumbIdleCursor;
+        forgetImage(path);
+        displayCurrentImage();
+        ensurePreloadWindow();
+    }
+    MoveAction restored = action;
+    restored.taskId = 0;
+    restored.state = static_cast<int>(FileTaskState::Done);
+    m_undoStack.push(restored);
+}
+
 void PhotoTriageWindow::undoLastAction()
 {
-    if (m_undoStack.empty()) {
+    if (m_undoStack.isEmpty()) {
         m_statusBar->showMessage(tr("Nothing to undo."));
         return;
     }
-    MoveAction action = m_undoStack.back();
-    m_undoStack.pop_back();
-    // Undo the move: if the move has not yet been processed by the
-    // background worker, cancel the pending task.  Otherwise move
-    // the file back from its destination to the original location.
-    bool originalExists = QFileInfo::exists(action.originalPath);
-    if (originalExists) {
-        // File is still at original location; cancel the queued move
-        if (m_fileWorker) {
-            m_fileWorker->cancelTask(action.originalPath);
-        }
+    const MoveAction action = m_undoStack.pop();
+    // The undo is journaled first, like the move.  A move that is still
+    // queued is simply cancelled; otherwise the file is moved back by the
+    // worker, on the lane of the move and after it, whether that move has
+    // landed, is in flight or is about to start.  The row comes back right
+    // away and is reconciled with the outcome in onUndoStateChanged().
+    const auto state = static_cast<FileTaskState>(action.state);
+    const bool cancelled = state == FileTaskState::Pending && m_fileWorker && m_fileWorker->cancel(action.taskId);
+    MoveJournal::Record undone;
+    undone.type = MoveJournal::Undone;
+    undone.moveId = action.journalId;
+    const quint64 sequence = m_journal->append(undone);
+    const QString restoredKey = QFileInfo(action.originalPath).absoluteFilePath();
+    quint64 undoTaskId = 0;
+    if (cancelled || !m_fileWorker) {
+        MoveJournal::Record restored;
+        restored.type = MoveJournal::UndoDone;
+        restored.moveId = action.journalId;
+        m_journal->append(restored);
+        const QFileInfo dest(action.destinationPath);
+        m_destNames.release(dest.absolutePath(), dest.fileName());
     } else {
-        // File has been moved; perform the reverse move
-        QDir origDir = QFileInfo(action.originalPath).absoluteDir();
-        if (!origDir.exists()) {
-            origDir.mkpath(".");
-        }
-        if (!QFile::rename(action.destinationPath, action.originalPath)) {
-            QMessageBox::critical(this, tr("Error Undoing File Move"), tr("Could not restore %1 to %2").arg(action.destinationPath, action.originalPath));
-            return;
-        }
-    }
-    // Reinsert file into list
-    int insertIndex = action.index;
-    if (insertIndex < 0) {
-        insertIndex = 0;
+        FileTask task;
+        task.source = action.destinationPath;
+        task.destination = action.originalPath;
+        task.journalId = action.journalId;
+        task.journalSequence = sequence;
+        task.undo = true;
+        task.undoes = action.taskId;
+        undoTaskId = m_fileWorker->enqueue(task);
+        m_undoing.insert(undoTaskId, { action, false });
+        m_restoring.insert(restoredKey);
     }
-    if (insertIndex > static_cast<int>(m_images.size())) {
-        insertIndex = static_cast<int>(m_images.size());
+    // Reinsert file into list, where insertSortedImages() would put it:
+    // the row it left may have moved since (rescans, another sort order,
+    // a filter, or a previous session for a replayed move), and later
+    // merges rely on m_images staying in order.
+    const QFileInfo restored(action.originalPath);
+    const bool appendOnly = viewSortField() != MetadataIndex::NoField;
+    const int insertIndex = appendOnly
+        ? static_cast<int>(m_images.size())
+        : static_cast<int>(std::upper_bound(m_images.begin(), m_images.end(), sortKey(restored),
+                                            [this](const QByteArray &key, const QFileInfo &row) {
+                                                return key < sortKey(row);
+                                            })
+                           - m_images.begin());
+    if (appendOnly || m_query.hasPredicates())
+        m_unplaced.insert(restoredKey);
+    {
+        QScopedValueRollback<bool> guard(m_syncingFileList, true);
+        m_fileListModel->beginInsertImage(insertIndex);
+        m_images.insert(m_images.begin() + insertIndex, restored);
+        m_fileListModel->endInsertImage();
     }
-    m_images.insert(m_images.begin() + insertIndex, QFileInfo(action.originalPath));
+    invalidateRowIndex(insertIndex);
     // Update current index
     m_currentIndex = insertIndex;
-    // Remove any cached entry for this image so it will be reloaded or re‑preloaded as needed
-    m_preloaded.remove(action.originalPath);
-    // Also clear any existing thumbnail for this path so a fresh one will be generated
-    m_thumbnailCache.remove(action.originalPath);
-    // Insert the restored entry into the file list widget instead of rebuilding all items.
-    if (m_fileListWidget) {
-        static QFileIconProvider iconProvider;
-        QListWidgetItem *newItem = new QListWidgetItem();
-        newItem->setText(QFileInfo(action.originalPath).fileName());
-        const QString opath = action.originalPath;
-        if (m_thumbnailCache.contains(opath)) {
-            newItem->setIcon(QIcon(m_thumbnailCache.value(opath)));
-        } else {
-            newItem->setIcon(iconProvider.icon(QFileInfo(opath)));
-        }
-        m_fileListWidget->insertItem(insertIndex, newItem);
-        // Select the newly restored item
-        m_fileListWidget->blockSignals(true);
-        m_fileListWidget->setCurrentRow(m_currentIndex);
-        m_fileListWidget->blockSignals(false);
+    m_movedAway.remove(restoredKey);
+    // Bring back the pixels stashed when the file was moved.  Without them
+    // (an older move, or one replayed from the journal) drop anything
+    // stale so the image and thumbnail are decoded afresh.
+    if (restoreMovedImage(action.destinationPath, restoredKey)) {
+        if (undoTaskId)
+            m_undoing[undoTaskId].restoredPixels = true;
+    } else {
+        forgetImage(restoredKey);
     }
+    // Let the idle pass see the restored row again.
+    m_thumbIdleCursor = qMin(m_thumbIdleCursor, insertIndex);
     displayCurrentImage();
     ensurePreloadWindow();
-    // Remove the restored file path from the loading set in case a load is
-    // still pending for this item.  We avoid clearing the entire loading
-    // state to preserve in‑flight thumbnail loads for other images.  Those
-    // loads will update icons correctly once they complete.
-    m_thumbLoadingPaths.remove(action.originalPath);
-    // Queue loading of any thumbnails that are still missing.  This will
-    // schedule the restored item for loading if needed.
-    startThumbnailLoaders();
-    // preloadNext();
+    // Ordered by metadata or filtered: move the row where the view wants
+    // it, keeping it current.
+    settleViewOrder();
 }
 
 // Move to the next image in the list without making any changes.  If already
@@ -873,7 +2036,7 @@ void PhotoTriageWindow::goToPreviousImage()
 
 // Respond to changes in the file list selection.  Updating m_currentIndex
 // allows the central image view to display the newly selected photo.  This
-// function is connected to the QListWidget::currentRowChanged signal.
+// function is connected to the list selection model's currentRowChanged signal.
 void PhotoTriageWindow::onFileListSelectionChanged(int row)
 {
     if (row < 0 || row >= static_cast<int>(m_images.size()))
@@ -883,48 +2046,3 @@ void PhotoTriageWindow::onFileListSelectionChanged(int row)
     displayCurrentImage();
     ensurePreloadWindow();
 }
-
-// Build or rebuild the file browser list.  Each entry displays a thumbnail
-// preview alongside the filename.  Thumbnails are generated synchronously
-// using scaled QPixmaps; because they are small (80×80) and we avoid loading
-// full-size pixmaps where possible, the performance impact remains acceptable
-// for modest numbers of images.  If images cannot be loaded, a placeholder
-// icon is used.
-void PhotoTriageWindow::populateFileList()
-{
-    if (!m_fileListWidget)
-        return;
-    m_fileListWidget->clear();
-    const int count = static_cast<int>(m_images.size());
-    // QFileIconProvider caches icons per file type and avoids costly image decoding.  Using
-    // it here keeps list population lightweight and preserves the responsive caching and
-    // preloading behaviour of the main image view.
-    static QFileIconProvider iconProvider;
-    m_fileListWidget->setUpdatesEnabled(false);
-    for (int i = 0; i < count; ++i) {
-        const QFileInfo &fi = m_images.at(i);
-        QListWidgetItem *item = new QListWidgetItem();
-        item->setText(fi.fileName());
-        // If a cached thumbnail exists, use it; otherwise use a generic file icon
-        const QString path = fi.absoluteFilePath();
-        if (m_thumbnailCache.contains(path)) {
-            item->setIcon(QIcon(m_thumbnailCache.value(path)));
-        } else {
-            item->setIcon(iconProvider.icon(fi));
-        }
-        m_fileListWidget->addItem(item);
-    }
-    m_fileListWidget->setUpdatesEnabled(true);
-    // Set the current selection and scroll into view without emitting signals
-    if (m_currentIndex >= 0 && m_currentIndex < count) {
-        m_fileListWidget->blockSignals(true);
-        m_fileListWidget->setCurrentRow(m_currentIndex);
-        m_fileListWidget->scrollToItem(m_fileListWidget->currentItem(), QAbstractItemView::PositionAtCenter);
-        m_fileListWidget->blockSignals(false);
-    }
-
-    // After building the list, start loading thumbnails asynchronously.  This
-    // call will skip items that already have cached previews or that are
-    // currently being loaded.
-    startThumbnailLoaders();
-}
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <QMainWindow>
+#include <QElapsedTimer>
 #include <QImage>
 #include <QHash>
 #include <QFileInfo>
@@ -13,25 +14,32 @@
 #include <deque>
 #include <QSet>
 #include <QQueue>
+#include <QCache>
+#include <QPixmap>
+
+#include "imagecache.h"
+#include "metadataindex.h"
+#include "nameindex.h"
+#include "undolog.h"
 
 class QLabel;
+class QLineEdit;
 class QPushButton;
 class QStatusBar;
-class ImageLoader;
-class QListWidget;
+class DecodePool;
+class DirectoryScanner;
+class QFileSystemWatcher;
+class ExifScanner;
+class QListView;
 class QAction;
+class QTimer;
 
 // Forward declarations for asynchronous file worker
 struct FileTask;
 class FileWorker;
-
-// Record of a move operation for undo purposes
-struct MoveAction
-{
-    QString originalPath;
-    QString destinationPath;
-    int index;
-};
+class MoveJournal;
+class ThumbnailStore;
+class ImageListModel;
 
 class PhotoTriageWindow : public QMainWindow
 {
@@ -42,7 +50,8 @@ public:
 
 protected:
 
-    void resizeEvent(QResizeEvent *event) override;
+    // Watches the image label so both window and splitter resizes are seen.
+    bool eventFilter(QObject *watched, QEvent *event) override;
     void closeEvent(QCloseEvent *event) override;
 
 private slots:
@@ -50,63 +59,338 @@ private slots:
     void handleMoveKeep();
     void handleMoveReject();
     void undoLastAction();
-    void onImagePreloaded(int index, const QString &path, const QImage &image);
+    void onImagePreloaded(const QString &path, const QImage &image);
+
+    // Progress of a keep/reject move from the file worker, recorded in the
+    // undo stack, or of an undo in m_undoing. A failed move leaves the file
+    // in the source folder; it is put back into the list.
+    void onMoveStateChanged(quint64 taskId, int state, const QString &source,
+                            const QString &destination, const QString &error);
+
+    // Dispatch a finished DecodePool job to the preload or thumbnail handler.
+    void onImageDecoded(const QString &path, int purpose, const QImage &image);
 
     // Navigate to the next and previous images without making a keep/reject decision.
     void goToNextImage();
     void goToPreviousImage();
 
+    // Merge a naturally sorted batch from the directory scanner into
+    // m_images, keeping the current image and the list's scroll position.
+    void onScanBatch(quint64 scanId, const QFileInfoList &files);
+    void onScanFinished(quint64 scanId, int total);
+
+    // A change the watcher reported in the source folder: matched against
+    // m_ownChanges, else re-listed once changes have settled.
+    void onSourceDirectoryChanged();
+    // Drop own changes that completed RESCAN_DEBOUNCE_MS ago.
+    void expireOwnChanges();
+    // Re-list the source folder after the watcher reported a change.
+    void startRescan();
+    void onRescanBatch(quint64 scanId, const QFileInfoList &files);
+    // Diff the fresh listing against m_images: insert new files at their
+    // natural positions, remove vanished ones in place and refresh files
+    // that were overwritten. Caches of untouched files are kept.
+    void onRescanFinished(quint64 scanId, int total);
+
     // Handle selection changes in the file browser list.
     void onFileListSelectionChanged(int row);
 
+    // Prompt for a new preload memory budget (in MB) and persist it.
+    void chooseCacheBudget();
+
+    // Switch between file-name and capture-time ordering and persist it.
+    void toggleCaptureTimeSort();
+    void onMetadataReady(quint64 jobId, const QStringList &paths, const QList<ExifMetadata> &metadata);
+
+    // Parse the filter box and apply it to the view. A syntax error is
+    // reported in the status bar and leaves the current filter in place.
+    void applyFilterText();
+    void focusFilter();
+
+    // Fired once the user has dwelt on a RAW image long enough to be worth
+    // starting the demosaic refinement stage.
+    void onRefineTimeout();
+
+    // Fired once the image label has stopped changing size: render the
+    // current image at full quality and re-request preloads for the new size.
+    void onResizeSettled();
+
 private:
+    // Row of `path` in m_images, or -1. O(1) amortised: backed by
+    // m_rowByPath, which is refreshed lazily from the first row that changed.
     int indexFromPath(const QString &path) const;
+    // Mark rows from `row` onward as shifted. Must be called after every
+    // insertion into or removal from m_images; removed paths must also be
+    // erased from m_rowByPath.
+    void invalidateRowIndex(int row);
+    // NaturalSort::key() of `file`, kept in m_sortKeys once encoded.
+    QByteArray sortKey(const QFileInfo &file);
 
     void loadSourceDirectory(const QString &directory);
     void displayCurrentImage();
     void ensurePreloadWindow();
-    void preloadNext();
+    // Eviction/fill rank of a row relative to the current index: 0 for the
+    // current image, growing with distance, with rows behind the cursor
+    // weighted twice as heavily as rows ahead. Negative for unknown rows.
+    int preloadRank(int row) const;
+    void updateCacheStatus();
+    // Size, in device pixels, that preloads are decoded at: the image label.
+    QSize displayTargetSize() const;
+    // True if `image` already fits the label size to within rounding.
+    bool fitsDisplay(const QImage &image) const;
+    // True if `image` is at least as large as the label size, so it can be
+    // scaled down for display instead of being decoded again.
+    bool coversDisplay(const QImage &image) const;
+    // Convert a decoded image for the label, rescaling only if it was
+    // decoded for a different size. Results are memoised in m_renderCache.
+    QPixmap renderForLabel(const QString &path, const QImage &image);
+    // Best decoded image available for `path`: the refinement if one is
+    // cached, else the preload. Only `recordLookup` counts towards the
+    // preload cache statistics.
+    QImage bestImageFor(const QString &path, bool recordLookup);
+    // Draw a fast-scaled frame while the label is being resized and
+    // (re)start the settle timer.
+    void onViewportResized();
     void performMove(const QString &action);
-    static bool naturalLess(const QFileInfo &a, const QFileInfo &b);
+    // Merge naturally sorted files into m_images, keeping the current image
+    // and the list's scroll position, then refresh the display.
+    void insertSortedImages(const QFileInfoList &files);
+    // Rebuild m_images from m_images and m_filteredOut for the active sort
+    // mode and filter, keeping the current image. When the order depends on
+    // metadata that is not indexed yet, the rebuild waits for m_exifScanner.
+    // Files not indexed yet pass every filter until their metadata arrives.
+    void applyViewOrder();
+    // Metadata field the view is ordered by, NoField for natural order.
+    MetadataIndex::Field viewSortField() const;
+    // Put the files in m_unplaced where the sort mode and filter want them
+    // once the folder scan and the metadata jobs have finished: one
+    // applyViewOrder() after a folder scan, single row moves for the few
+    // files a rescan adds, so the list neither resets nor jumps meanwhile.
+    void settleViewOrder();
+    void placeIndexedImages();
+    // Send every listed file the metadata index does not cover yet to
+    // m_exifScanner, unless a job is already running (the next one starts
+    // when it finishes).
+    void indexMetadata();
+    // Replay the journal of the folder just opened: queue the moves a
+    // previous session decided but never carried out, rebuild the undo
+    // stack and compact the journal.
+    void recoverMoves();
+    // Reconcile the row put back by undoLastAction() with the outcome of
+    // the undo task: refresh it once the file has landed, or take it out
+    // again and restore the undo entry if the file could not be moved back.
+    struct PendingUndo;
+    void onUndoStateChanged(QHash<quint64, PendingUndo>::iterator undoing, int taskState, const QString &error);
+    // Drop every cached image, thumbnail and pending decode for `path`.
+    void forgetImage(const QString &path);
+    // Follow a file task through m_ownChanges.
+    void trackOwnChange(quint64 taskId, int taskState);
+    // False while `path` cannot be decoded: it failed before and has not
+    // changed since, or an undo has yet to move it back.
+    bool canDecode(const QString &path) const;
+    // Move the decoded images and thumbnail of `path`, which is being moved
+    // to `destination`, from the caches into m_recentlyMoved, and back.
+    // restoreMovedImage() returns false if nothing was stashed.
+    void stashMovedImage(const QString &path, const QString &destination);
+    bool restoreMovedImage(const QString &destination, const QString &path);
 
     QPushButton* m_openButton = nullptr;
     QAction* m_openAct = nullptr; // menu action
     QString m_lastDir; // remember last directory
 
-    // Populate the side file browser with the current set of images. This helper
-    // clears m_fileListWidget and inserts an entry for each element in
-    // m_images.  It should be called whenever the contents of m_images change
-    // substantially, such as after loading a directory, moving files, or
-    // undoing an action.
-    void populateFileList();
+    // Select and centre the current row in the side file browser without
+    // feeding the change back into onFileListSelectionChanged().
+    void syncFileListSelection();
 
     // Data
     std::vector<QFileInfo> m_images;
     int m_currentIndex = -1;
+    // Absolute path -> row in m_images. Entries for rows at or beyond
+    // m_rowIndexDirtyFrom may be stale until indexFromPath() refreshes them;
+    // a keep/reject or undo therefore costs one pass over the rows below
+    // the change rather than a scan per lookup.
+    mutable QHash<QString, int> m_rowByPath;
+    mutable int m_rowIndexDirtyFrom = 0;
+    // Natural-order keys of the listed files by absolute path, so merging
+    // a batch compares against each existing row without re-encoding it.
+    // Dropped with the folder.
+    QHash<QString, QByteArray> m_sortKeys;
     // Cache of preloaded images keyed by the absolute file path. This
     // allows the cache to remain valid even when indices shift after
-    // removing items.
-    QHash<QString, QImage> m_preloaded;
-    std::deque<MoveAction> m_undoStack;
-    static constexpr int MAX_UNDO = 20;
-
-    // Preloading queue: indices of images currently loading ahead
-    QSet<int> m_loading;
-    static constexpr int PRELOAD_DEPTH = 10;
-
-    // Number of images behind the current index to keep preloaded in the
-    // cache. Keeping a small window of previous images allows the user to
-    // navigate backwards with minimal delay. This complements the forward
-    // preload depth and helps deliver a fluid browsing experience.
-    // Preload a generous number of previous images to enable lightning‑fast
-    // backward navigation. Increasing this depth ensures that recently
-    // viewed items remain in memory when the user presses the left arrow key.
-    // A value of 5 strikes a balance between memory consumption and
-    // performance.
-    static constexpr int PRELOAD_BACK_DEPTH = 5;
+    // removing items. The cache is bounded by a memory budget rather than a
+    // fixed number of images: ensurePreloadWindow() fills outward from the
+    // cursor as far as the budget allows and eviction drops the images
+    // furthest from the cursor first.
+    ImageCache m_preloaded;
+    // Files no decoder could read. They are not queued again, for display or
+    // as thumbnails, until the folder watcher sees their size or
+    // modification time change and forgetImage() drops them from here, so a
+    // corrupt file or one still being copied does not keep a decode thread
+    // busy.
+    QSet<QString> m_undecodable;
+    // Path of the image last shown by displayCurrentImage(), whether the full
+    // image or a placeholder.
+    QString m_displayedPath;
+
+    // RAW refinement. Navigation only ever waits for the fast embedded
+    // preview; if the user stays on a RAW for REFINE_DWELL_MS a half-size
+    // demosaic is queued. It is cached in m_refined (a quarter of the
+    // preload budget) and cancelled as soon as the user moves to another
+    // image.
+    ImageCache m_refined;
+    QTimer *m_refineTimer = nullptr;
+    static constexpr int REFINE_DWELL_MS = 600;
+
+    // Resize handling. While the label is being resized only a fast-scaled
+    // copy of the last rendered pixmap is drawn; the smooth render happens
+    // once no resize has arrived for RESIZE_SETTLE_MS. Rendered pixmaps are
+    // kept per (image, size), so returning to an earlier window size or
+    // toggling fullscreen reuses them. Costs are in KiB.
+    QTimer *m_resizeSettleTimer = nullptr;
+    QPixmap m_lastRendered;
+    QCache<QString, QPixmap> m_renderCache;
+    static constexpr int RESIZE_SETTLE_MS = 150;
+    static constexpr int RENDER_CACHE_KB = 128 * 1024;
+    // Every move still in effect, newest on top. Rebuilt from the journal
+    // when a folder is opened.
+    UndoLog m_undoStack;
+
+    // Decoded pixels of the most recently moved files, keyed by destination
+    // path, so undoing a move shows the image and its thumbnail again
+    // without touching the disk. Entries are screen-sized like everything
+    // in m_preloaded; the oldest is dropped beyond RECENTLY_MOVED_IMAGES.
+    struct MovedImage
+    {
+        QString destination;
+        QImage image;
+        QImage refinedHalf;
+        QPixmap thumbnail;
+    };
+    std::deque<MovedImage> m_recentlyMoved;
+    static constexpr int RECENTLY_MOVED_IMAGES = 8;
+
+    // Default memory budget for m_preloaded, overridable through the
+    // "cache/budgetMB" setting.
+    static constexpr int DEFAULT_CACHE_BUDGET_MB = 1024;
+
+    // Hard limits on how far the preload window may extend, however small
+    // the images are. Backward navigation is less common, so the window
+    // reaches half as far behind the cursor as ahead of it.
+    static constexpr int MAX_PRELOAD_AHEAD = 100;
+    static constexpr int MAX_PRELOAD_BEHIND = 50;
 
     // Background worker for file operations
     FileWorker *m_fileWorker = nullptr;
+    // Write-ahead log of keep/reject/undo for the current folder, so a
+    // crash loses neither queued moves nor the undo history.
+    MoveJournal *m_journal = nullptr;
+    // File names taken in the keep and discard folders, so picking a free
+    // destination name never stats the folder on the GUI thread.
+    NameIndex m_destNames;
+
+    // Shared pool of decode threads for preloads and thumbnails. Jobs are
+    // ordered by the priorities below (lower runs first): the image nearest
+    // the cursor comes first, then its neighbours by distance, then
+    // thumbnails for the rows on screen, then thumbnails for the rows within
+    // THUMB_NEAR_PAGES pages of the scroll position, and finally, at idle
+    // priority in folder order, thumbnails for everything else.
+    DecodePool *m_decodePool = nullptr;
+    static constexpr int THUMB_PRIORITY_BASE = 1000;
+    static constexpr int THUMB_NEAR_PRIORITY_BASE = 100000;
+    static constexpr int THUMB_IDLE_PRIORITY_BASE = 1000000;
+    static constexpr int THUMB_NEAR_PAGES = 2;
+
+    // Navigation generation for preload jobs. Bumped on every window update;
+    // preloads not resubmitted under the new generation are dropped from the
+    // pool queue or aborted mid-decode.
+    quint64 m_preloadGeneration = 0;
+
+    // Lists the source folder off the GUI thread. Batches from a scan other
+    // than m_scanId (an earlier folder) are ignored; m_scanning is true
+    // until the current scan has delivered everything.
+    DirectoryScanner *m_scanner = nullptr;
+    quint64 m_scanId = 0;
+    bool m_scanning = false;
+
+    // Live folder watching. Changes are coalesced for RESCAN_DEBOUNCE_MS and
+    // then the folder is re-listed on m_rescanner and diffed against
+    // m_images. m_movedAway holds files queued for a keep/reject move, which
+    // stay in the folder until the worker has moved them and must not be
+    // re-added in the meantime.
+    QFileSystemWatcher *m_dirWatcher = nullptr;
+    DirectoryScanner *m_rescanner = nullptr;
+    QTimer *m_rescanTimer = nullptr;
+    quint64 m_rescanId = 0;
+    bool m_rescanning = false;
+    bool m_rescanPending = false;
+    QFileInfoList m_rescanFiles;
+    QSet<QString> m_movedAway;
+    // Keep/reject moves and undos change the source folder themselves, and
+    // a rescan for each of them would re-list the whole folder after every
+    // keypress. Each task that starts running is expected to cause one
+    // notification, which is matched to the oldest unmatched task instead
+    // of starting a rescan. A task that completes without its notification
+    // having been seen within RESCAN_DEBOUNCE_MS was reported together with
+    // another change, which may not have been ours, so it causes a rescan
+    // after all; so does a failed task that had been matched. Anything
+    // beyond the expected notifications (a cross-device copy reports
+    // several) is treated as a foreign change.
+    struct OwnChange
+    {
+        quint64 taskId = 0;
+        bool seen = false;
+        qint64 doneAt = -1;     // on m_ownChangeClock, once completed
+    };
+    std::deque<OwnChange> m_ownChanges;
+    QElapsedTimer m_ownChangeClock;
+    QTimer *m_ownChangeTimer = nullptr;
+    // Undos being carried out by the file worker, by task id, and the paths
+    // they restore. Their rows are back in m_images before the files are,
+    // so a rescan in between must not drop them, and nothing is decoded for
+    // them until the file has landed. `restoredPixels` is set if the row
+    // came back with the pixels stashed at move time.
+    struct PendingUndo
+    {
+        MoveAction action;
+        bool restoredPixels = false;
+    };
+    QHash<quint64, PendingUndo> m_undoing;
+    QSet<QString> m_restoring;
+    // Paths whose undo landed while the current rescan was listing: the
+    // listing may predate them, so its end must not take their rows out.
+    // Trusting the listing otherwise keeps stat calls, which can hang on a
+    // dropped share, off the GUI thread.
+    QSet<QString> m_restoredDuringRescan;
+    static constexpr int RESCAN_DEBOUNCE_MS = 500;
+
+    // Shooting metadata for every file of the folder, read in the
+    // background by m_exifScanner as files are listed and kept for the
+    // lifetime of the folder. It drives the optional ordering by capture
+    // time (the "view/sortByCaptureTime" setting) and the filter box.
+    bool m_sortByCaptureTime = false;
+    ExifScanner *m_exifScanner = nullptr;
+    MetadataIndex m_metadata;
+    quint64 m_metadataJobId = 0;
+    bool m_metadataJobRunning = false;
+    // Files listed since the view was last ordered that were not indexed
+    // then: appended at the end when ordering by metadata, and not checked
+    // against the filter. Above MAX_ROW_PLACEMENTS of them the view is
+    // rebuilt instead of moving rows one at a time.
+    QSet<QString> m_unplaced;
+    static constexpr int MAX_ROW_PLACEMENTS = 64;
+    // applyViewOrder() is waiting for metadata to rebuild the whole view.
+    bool m_reorderPending = false;
+
+    // Filtering partitions the folder rather than layering a proxy model on
+    // top: m_images holds the files that pass m_query and everything else
+    // (navigation, preloading, the file list) keeps working on it unchanged,
+    // while the files filtered out wait in m_filteredOut. Typing is
+    // debounced by FILTER_DELAY_MS.
+    QLineEdit *m_filterEdit = nullptr;
+    QTimer *m_filterTimer = nullptr;
+    MetadataIndex::Query m_query;
+    std::vector<QFileInfo> m_filteredOut;
+    static constexpr int FILTER_DELAY_MS = 200;
 
     // Directories
     QString m_sourceDir;
@@ -116,54 +400,73 @@ private:
     // UI elements
     QLabel *m_imageLabel;
     QStatusBar *m_statusBar;
+    QLabel *m_cacheStatusLabel = nullptr; // resident bytes and hit rate
     QPushButton *m_keepButton;
     QPushButton *m_rejectButton;
     QPushButton *m_undoButton;
 
-    // Side panel for browsing available images. This list displays
-    // thumbnails and filenames for all images in the current
-    // directory and allows the user to jump directly to any photo.
-    QListWidget *m_fileListWidget;
+    // Side panel for browsing available images. The view displays
+    // thumbnails and filenames for all images in the current directory and
+    // allows the user to jump directly to any photo. Its model reads
+    // m_images and m_thumbnailCache directly, so no per-file items exist and
+    // keep/reject/undo become single row removals/insertions.
+    QListView *m_fileListView = nullptr;
+    ImageListModel *m_fileListModel = nullptr;
+    // Set while the window moves the list's current row itself.
+    bool m_syncingFileList = false;
 
     // Thumbnail cache keyed by absolute file path. Each entry stores a
     // QPixmap that represents a small preview. Caching prevents
     // repeatedly decoding the same image when it appears in the file list.
     QHash<QString, QPixmap> m_thumbnailCache;
 
-    // Set of file paths currently being loaded asynchronously for
-    // thumbnails. Using the file path rather than the list index makes
-    // the tracking robust when rows shift due to keep/discard/undo
-    // operations. This prevents launching duplicate loaders for the same
-    // image and provides a simple way to limit the number of concurrent
-    // loads.
-    QSet<QString> m_thumbLoadingPaths;
-
-    // Queue of thumbnail indices awaiting loading. When thumbnails
-    // are missing from the cache, their indices are enqueued here and
-    // processed in a limited‑concurrency manner. This avoids
-    // spawning one thread per thumbnail and dramatically improves
-    // responsiveness when loading large folders.
-    QQueue<int> m_thumbPending;
-
-    // Maximum number of thumbnail loads to run concurrently. Keeping
-    // this number small prevents CPU and I/O saturation while still
-    // populating thumbnails quickly in the background.
-    static constexpr int MAX_THUMB_CONCURRENCY = 3;
-
-    // Kick off asynchronous thumbnail loading for any images that lack
-    // cached thumbnails. Populates m_thumbPending and starts up to
-    // MAX_THUMB_CONCURRENCY loaders immediately.
-    void startThumbnailLoaders();
-
-    // Start the next queued thumbnail loader if fewer than
-    // MAX_THUMB_CONCURRENCY loads are currently running.
-    void startNextThumbnailLoader();
-
-    // Slot to receive loaded thumbnails. Updates the cache and the
-    // corresponding list item's icon.  Connected to ImageLoader::loaded for
-    // thumbnail loaders. Removes the file path from
-    // m_thumbLoadingPaths and triggers another queued load if any are
-    // pending.
-    void onThumbnailLoaded(int index, const QString &path, const QImage &image);
-    // Loader for current image is handled asynchronously via ImageLoader instances
+    // Persistent backing store for m_thumbnailCache. Thumbnails decoded in
+    // earlier sessions are served from its memory-mapped pack file, so only
+    // new or modified files need to go through ImageLoader.
+    ThumbnailStore *m_thumbStore = nullptr;
+
+    // Thumbnail scheduling follows the file list viewport. Whenever it
+    // scrolls or changes size, scheduleThumbnails() (coalesced on the next
+    // event loop pass) raises the rows on screen and the rows near them to
+    // the visible/near priority bands and lowers the rows that have left
+    // that range back to idle priority; only those two windows are touched,
+    // never the whole folder. Rows the model asks for while painting are
+    // collected in m_thumbPending and handled in the same pass.
+    // m_thumbRequested remembers the paths already resolved or in flight;
+    // m_thumbBoosted those currently queued above idle priority.
+    QSet<QString> m_thumbPending;
+    QSet<QString> m_thumbRequested;
+    QSet<QString> m_thumbBoosted;
+    QTimer *m_thumbRequestTimer = nullptr;
+    // The remaining rows are queued at idle priority a batch at a time from
+    // m_thumbIdleCursor, skipping any the persistent store already holds.
+    QTimer *m_thumbIdleTimer = nullptr;
+    int m_thumbIdleCursor = 0;
+    static constexpr int THUMB_IDLE_BATCH = 256;
+    static constexpr int THUMB_IDLE_INTERVAL_MS = 20;
+
+    // Called by the model for a painted row without a cached thumbnail.
+    void requestThumbnail(int row);
+
+    // Re-rank thumbnail work around the current file list viewport.
+    void scheduleThumbnails();
+
+    // Make sure the thumbnail for `row` is cached or queued at `priority`.
+    // Store hits are applied immediately; a row already queued is only
+    // re-prioritised. Returns true if a decode job is (still) queued.
+    bool requestThumbnailAt(int row, int priority);
+
+    // Queue the next batch of off-screen thumbnails at idle priority.
+    void queueIdleThumbnails();
+
+    // Slot to receive loaded thumbnails. Updates the cache and repaints the
+    // corresponding list row.
+    void onThumbnailLoaded(const QString &path, const QImage &image);
+
+    // Receive a RefineHalf result: cache it and show it if the image is
+    // still current.
+    void onImageRefined(const QString &path, int purpose, const QImage &image);
+
+    // Cache key for a refinement of `path` in m_refined.
+    static QString refinedKey(const QString &path, int purpose);
 };
@@ -2,9 +2,14 @@
 #include "rawloader.h"
 #include <libraw/libraw.h>
 #include <QImage>
+#include <QImageReader>
+#include <QBuffer>
 #include <QByteArray>
 
-static QImage qimageFromMemImage(const libraw_processed_image_t* img)
+// `maxSize`, if valid, bounds the decoded size of JPEG previews so the
+// decoder can use scaled IDCT instead of a full-resolution decode.
+static QImage qimageFromMemImage(const libraw_processed_image_t* img,
+                                 QSize maxSize = QSize())
 {
     if (!img) return {};
     if (img->type == LIBRAW_IMAGE_BITMAP) {
@@ -17,28 +22,54 @@ static QImage qimageFromMemImage(const libraw_processed_image_t* img)
         memcpy(out.bits(), data, size_t(w)*h*3);
         return out;
     } else if (img->type == LIBRAW_IMAGE_JPEG) {
-        // Decode JPEG buffer to QImage
-        QByteArray ba(reinterpret_cast<const char*>(img->data), int(img->data_size));
+        // Decode JPEG buffer to QImage, reading LibRaw's buffer in place
+        QByteArray ba = QByteArray::fromRawData(reinterpret_cast<const char*>(img->data),
+                                                qsizetype(img->data_size));
+        QBuffer buffer(&ba);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer, "jpeg");
+        if (maxSize.isValid() && !maxSize.isEmpty()) {
+            const QSize source = reader.size();
+            if (source.isValid() && !source.isEmpty())
+                reader.setScaledSize(source.scaled(maxSize, Qt::KeepAspectRatio));
+        }
         QImage out;
-        out.loadFromData(ba, "JPG");
+        reader.read(&out);
         return out;
     }
     return {};
 }
 
-bool RawLoader::loadEmbeddedPreview(const QString& path, QImage& out)
+static bool isCancelled(const std::atomic_bool* cancel)
+{
+    return cancel && cancel->load(std::memory_order_relaxed);
+}
+
+// LibRaw progress hook: a non-zero return aborts the current stage with
+// LIBRAW_CANCELLED_BY_CALLBACK.
+static int progressCallback(void* data, enum LibRaw_progress, int, int)
+{
+    return isCancelled(static_cast<const std::atomic_bool*>(data)) ? 1 : 0;
+}
+
+bool RawLoader::loadEmbeddedPreview(const QString& path, QImage& out, QSize maxSize,
+                                    const std::atomic_bool* cancel)
 {
     LibRaw raw;
     if (raw.open_file(path.toLocal8Bit().constData()) != LIBRAW_SUCCESS)
         return false;
 
-    if (raw.unpack_thumb() != LIBRAW_SUCCESS)
+    if (isCancelled(cancel) || raw.unpack_thumb() != LIBRAW_SUCCESS)
         return false;
 
     const libraw_processed_image_t* pi = raw.dcraw_make_mem_thumb();
     if (!pi) return false;
 
-    QImage img = qimageFromMemImage(pi);
+    // The orientation is applied after decoding, so bound the decode by the
+    // transposed size for previews that will be turned by 90 degrees.
+    const int flip = raw.imgdata.sizes.flip;
+    const bool quarterTurn = flip == 5 || flip == 6 || flip == 8;
+    QImage img = qimageFromMemImage(pi, quarterTurn ? maxSize.transposed() : maxSize);
     raw.dcraw_clear_mem(const_cast<libraw_processed_image_t*>(pi));
     if (img.isNull()) return false;
 
@@ -52,14 +83,17 @@ bool RawLoader::loadEmbeddedPreview(const QString& path, QImage& out)
     return true;
 }
 
-bool RawLoader::loadDemosaiced(const QString& path, QImage& out, bool halfSize)
+bool RawLoader::loadDemosaiced(const QString& path, QImage& out, bool halfSize,
+                               const std::atomic_bool* cancel)
 {
     LibRaw raw;
+    if (cancel)
+        raw.set_progress_handler(&progressCallback, const_cast<std::atomic_bool*>(cancel));
     if (raw.open_file(path.toLocal8Bit().constData()) != LIBRAW_SUCCESS)
         return false;
 
     // Unpack RAW data
-    if (raw.unpack() != LIBRAW_SUCCESS)
+    if (isCancelled(cancel) || raw.unpack() != LIBRAW_SUCCESS)
         return false;
 
     // Postprocess params: make something pleasant for screen
@@ -69,7 +103,7 @@ bool RawLoader::loadDemosaiced(const QString& path, QImage& out, bool halfSize)
     raw.imgdata.params.output_color  = 1;  // sRGB
     raw.imgdata.params.half_size     = halfSize ? 1 : 0; // speed win!
 
-    if (raw.dcraw_process() != LIBRAW_SUCCESS)
+    if (isCancelled(cancel) || raw.dcraw_process() != LIBRAW_SUCCESS)
         return false;
 
     const libraw_processed_image_t* pi = raw.dcraw_make_mem_image();
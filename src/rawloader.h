@@ -1,13 +1,23 @@
 // rawloader.h
 #pragma once
 #include <QImage>
+#include <QSize>
 #include <QString>
+#include <atomic>
 
 namespace RawLoader {
-    // Fast: use embedded preview (JPEG) if present.
-    bool loadEmbeddedPreview(const QString& path, QImage& out);
+    // Both loaders give up (returning false) once `cancel` becomes true.
 
-    // Full demosaic to 8-bit sRGB (heavier but best quality).
+    // Fast: use embedded preview (JPEG) if present. A valid `maxSize` lets
+    // the JPEG decoder downscale while decoding (aspect ratio preserved).
+    bool loadEmbeddedPreview(const QString& path, QImage& out,
+                             QSize maxSize = QSize(),
+                             const std::atomic_bool* cancel = nullptr);
+
+    // Full demosaic to 8-bit sRGB (heavier but best quality). The cancel
+    // flag is also polled from LibRaw's progress callback, so a running
+    // dcraw_process() is aborted rather than run to completion.
     bool loadDemosaiced(const QString& path, QImage& out,
-                        bool halfSize=true); // halfSize is faster.
+                        bool halfSize=true, // halfSize is faster.
+                        const std::atomic_bool* cancel = nullptr);
 }
@@ -0,0 +1,224 @@
+// thumbnailstore.cpp
+
+#include "thumbnailstore.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+
+#include <cstring>
+
+namespace {
+// Pack files start with this header so a foreign or truncated file is
+// detected and replaced rather than mapped blindly.
+constexpr char PACK_MAGIC[8] = { 'C', 'P', 'X', 'T', 'H', 'M', 'B', '1' };
+constexpr quint32 INDEX_MAGIC = 0x43505849; // "CPXI"
+constexpr quint32 INDEX_VERSION = 2; // 2: thumbnails keep their aspect ratio
+}
+
+ThumbnailStore::ThumbnailStore() = default;
+
+ThumbnailStore::~ThumbnailStore()
+{
+    close();
+}
+
+bool ThumbnailStore::open(const QString &directory)
+{
+    close();
+    if (!QDir().mkpath(directory))
+        return false;
+
+    m_indexPath = QDir(directory).filePath(QStringLiteral("thumbs.idx"));
+    m_pack.setFileName(QDir(directory).filePath(QStringLiteral("thumbs.pack")));
+    if (!m_pack.open(QIODevice::ReadWrite)) {
+        qWarning() << "ThumbnailStore: cannot open" << m_pack.fileName();
+        return false;
+    }
+
+    // Validate the header; anything unexpected (or an oversized pack) starts
+    // a fresh store instead of trying to salvage it.
+    char magic[sizeof(PACK_MAGIC)] = {};
+    const bool validHeader = m_pack.size() >= qint64(sizeof(PACK_MAGIC))
+                             && m_pack.read(magic, sizeof(magic)) == qint64(sizeof(magic))
+                             && std::memcmp(magic, PACK_MAGIC, sizeof(magic)) == 0;
+    if (!validHeader || m_pack.size() > MAX_PACK_BYTES || !loadIndex()) {
+        reset();
+    }
+    remap();
+    return true;
+}
+
+void ThumbnailStore::close()
+{
+    if (!m_pack.isOpen())
+        return;
+    saveIndex();
+    if (m_map) {
+        m_pack.unmap(m_map);
+        m_map = nullptr;
+        m_mappedSize = 0;
+    }
+    m_pack.close();
+    m_index.clear();
+}
+
+bool ThumbnailStore::find(const QString &path, qint64 size, qint64 mtime, QImage &out)
+{
+    auto it = m_index.constFind(path);
+    if (it == m_index.constEnd())
+        return false;
+    const Entry &e = it.value();
+    if (e.size != size || e.mtime != mtime)
+        return false;
+
+    const qint64 bytes = qint64(e.bytesPerLine) * e.height;
+    if (e.offset + bytes > m_mappedSize && !remap())
+        return false;
+    if (e.offset + bytes > m_mappedSize)
+        return false;
+
+    // Wrap the mapped pixels without decoding, then detach so the caller's
+    // image survives a later remap of the pack.
+    const QImage view(m_map + e.offset, e.width, e.height, e.bytesPerLine,
+                      static_cast<QImage::Format>(e.format));
+    out = view.copy();
+    return !out.isNull();
+}
+
+bool ThumbnailStore::contains(const QString &path, qint64 size, qint64 mtime) const
+{
+    auto it = m_index.constFind(path);
+    return it != m_index.constEnd() && it->size == size && it->mtime == mtime;
+}
+
+void ThumbnailStore::insert(const QString &path, qint64 size, qint64 mtime, const QImage &thumb)
+{
+    if (!m_pack.isOpen() || thumb.isNull())
+        return;
+    if (thumb.width() > 0xFFFF || thumb.height() > 0xFFFF)
+        return;
+
+    const QImage img = thumb.convertToFormat(thumb.hasAlphaChannel()
+                                                 ? QImage::Format_ARGB32_Premultiplied
+                                                 : QImage::Format_RGB888);
+    const qint64 bytes = qint64(img.bytesPerLine()) * img.height();
+
+    // Keep every entry 4-byte aligned so the mapped scanlines satisfy
+    // QImage's alignment requirements.
+    qint64 offset = m_pack.size();
+    qint64 pad = (4 - (offset % 4)) % 4;
+    // A full pack starts over, as an oversized one does on open: the
+    // thumbnails still needed are decoded and appended again.
+    if (offset + pad + bytes > MAX_PACK_BYTES) {
+        reset();
+        offset = m_pack.size();
+        pad = (4 - (offset % 4)) % 4;
+    }
+    if (!m_pack.seek(offset))
+        return;
+    if (pad) {
+        const char zeros[4] = {};
+        if (m_pack.write(zeros, pad) != pad)
+            return;
+        offset += pad;
+    }
+    if (m_pack.write(reinterpret_cast<const char *>(img.constBits()), bytes) != bytes)
+        return;
+
+    Entry e;
+    e.size = size;
+    e.mtime = mtime;
+    e.offset = offset;
+    e.width = quint16(img.width());
+    e.height = quint16(img.height());
+    e.bytesPerLine = quint32(img.bytesPerLine());
+    e.format = quint8(img.format());
+    m_index.insert(path, e);
+    m_dirty = true;
+}
+
+bool ThumbnailStore::remap()
+{
+    if (m_map) {
+        m_pack.unmap(m_map);
+        m_map = nullptr;
+        m_mappedSize = 0;
+    }
+    m_pack.flush();
+    const qint64 size = m_pack.size();
+    if (size <= 0)
+        return false;
+    m_map = m_pack.map(0, size);
+    if (!m_map)
+        return false;
+    m_mappedSize = size;
+    return true;
+}
+
+void ThumbnailStore::reset()
+{
+    if (m_map) {
+        m_pack.unmap(m_map);
+        m_map = nullptr;
+        m_mappedSize = 0;
+    }
+    m_index.clear();
+    m_pack.resize(0);
+    m_pack.seek(0);
+    m_pack.write(PACK_MAGIC, sizeof(PACK_MAGIC));
+    m_pack.flush();
+    // An old index left on disk would point into the new pixels after a
+    // crash.
+    m_dirty = true;
+    saveIndex();
+}
+
+bool ThumbnailStore::loadIndex()
+{
+    QFile f(m_indexPath);
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&f);
+    quint32 magic = 0, version = 0, count = 0;
+    in >> magic >> version >> count;
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION)
+        return false;
+
+    const qint64 packSize = m_pack.size();
+    m_index.clear();
+    m_index.reserve(int(count));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString path;
+        Entry e;
+        in >> path >> e.size >> e.mtime >> e.offset >> e.width >> e.height
+           >> e.bytesPerLine >> e.format;
+        // An index pointing past the end of the pack means the two files are
+        // out of sync (e.g. the pack was replaced); reject it wholesale.
+        if (e.offset + qint64(e.bytesPerLine) * e.height > packSize)
+            return false;
+        m_index.insert(path, e);
+    }
+    m_dirty = false;
+    return in.status() == QDataStream::Ok;
+}
+
+void ThumbnailStore::saveIndex()
+{
+    if (!m_dirty)
+        return;
+    m_pack.flush();
+    QSaveFile f(m_indexPath);
+    if (!f.open(QIODevice::WriteOnly))
+        return;
+    QDataStream out(&f);
+    out << INDEX_MAGIC << INDEX_VERSION << quint32(m_index.size());
+    for (auto it = m_index.constBegin(); it != m_index.constEnd(); ++it) {
+        const Entry &e = it.value();
+        out << it.key() << e.size << e.mtime << e.offset << e.width << e.height
+            << e.bytesPerLine << e.format;
+    }
+    if (f.commit())
+        m_dirty = false;
+}
@@ -0,0 +1,69 @@
+// thumbnailstore.h
+//
+// Declares the ThumbnailStore class, a persistent on-disk cache for the
+// small previews shown in the file browser. Thumbnails are stored as raw
+// pixels in a single append-only pack file which is memory-mapped for
+// reading, alongside a compact index keyed by absolute path. An entry is
+// only considered valid while the file size and modification time still
+// match, so edited or replaced files are transparently re-decoded.
+
+#pragma once
+
+#include <QFile>
+#include <QHash>
+#include <QImage>
+#include <QString>
+
+class ThumbnailStore
+{
+public:
+    ThumbnailStore();
+    ~ThumbnailStore();
+
+    // Open (or create) the pack and index inside `directory`. Returns false
+    // if the files cannot be created; the store then behaves as empty.
+    bool open(const QString &directory);
+
+    // Persist the index and release the mapping. Safe to call repeatedly.
+    void close();
+
+    // Look up the thumbnail for `path`. Succeeds only if an entry exists and
+    // its recorded size and mtime (ms since epoch) match the arguments.
+    bool find(const QString &path, qint64 size, qint64 mtime, QImage &out);
+
+    // True if find() would succeed, without touching the pixel data.
+    bool contains(const QString &path, qint64 size, qint64 mtime) const;
+
+    // Append a thumbnail to the pack, replacing any previous entry for the
+    // same path. Images are stored in RGB888 unless they carry alpha.
+    void insert(const QString &path, qint64 size, qint64 mtime, const QImage &thumb);
+
+private:
+    struct Entry
+    {
+        qint64 size = 0;
+        qint64 mtime = 0;
+        qint64 offset = 0;      // byte offset of the pixel data in the pack
+        quint16 width = 0;
+        quint16 height = 0;
+        quint32 bytesPerLine = 0;
+        quint8 format = 0;      // QImage::Format value
+    };
+
+    bool remap();
+    void reset();
+    bool loadIndex();
+    void saveIndex();
+
+    QString m_indexPath;
+    QFile m_pack;
+    uchar *m_map = nullptr;
+    qint64 m_mappedSize = 0;
+    QHash<QString, Entry> m_index;
+    bool m_dirty = false;
+
+    // Packs larger than this are discarded on open, and an insert that
+    // would grow the pack past it starts a fresh one; stale entries are
+    // never reclaimed in place so this bounds the on-disk footprint.
+    static constexpr qint64 MAX_PACK_BYTES = qint64(1) << 30;
+};
@@ -0,0 +1,292 @@
+// tiffpreview.cpp
+
+#include "tiffpreview.h"
+#include "tiffview.h"
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImageReader>
+#include <QStorageInfo>
+#include <QTransform>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+constexpr quint16 TAG_COMPRESSION = 0x0103;
+constexpr quint16 TAG_STRIP_OFFSETS = 0x0111;
+constexpr quint16 TAG_ORIENTATION = 0x0112;
+constexpr quint16 TAG_STRIP_BYTE_COUNTS = 0x0117;
+constexpr quint16 TAG_SUB_IFDS = 0x014A;
+constexpr quint16 TAG_JPEG_OFFSET = 0x0201;
+constexpr quint16 TAG_JPEG_LENGTH = 0x0202;
+
+constexpr quint16 COMPRESSION_OLD_JPEG = 6;
+constexpr quint16 COMPRESSION_JPEG = 7;
+
+// Guards against IFD loops and absurd files.
+constexpr int MAX_IFDS = 64;
+// A preview whose long edge is below this only stands in for targets
+// smaller than itself (thumbnails); NEF and PEF carry 160 px ones in IFD0.
+constexpr int MIN_PREVIEW_EDGE = 1024;
+// When the file is read rather than mapped: IFDs are looked for in its
+// first IFD_WINDOW bytes, and each candidate JPEG's frame header in its
+// first JPEG_PROBE_BYTES (room for a full Exif segment ahead of it).
+constexpr qint64 IFD_WINDOW = 1024 * 1024;
+constexpr qint64 JPEG_PROBE_BYTES = 128 * 1024;
+
+// File systems of fixed local disks. Anywhere else (network shares, FAT
+// and exFAT cards, FUSE mounts) a page of a mapping that cannot be read,
+// because the file was truncated or the device went away, raises SIGBUS,
+// so those files are read instead.
+const char *const MAPPABLE_FILE_SYSTEMS[] = {
+    "ext2", "ext3", "ext4", "xfs", "btrfs", "zfs", "f2fs", "bcachefs", "tmpfs", "apfs", "ntfs", "refs",
+};
+
+struct Candidate
+{
+    qint64 offset = 0;
+    qint64 length = 0;
+    QSize size;
+};
+
+// Read the frame header of a JPEG stream, of which `length` bytes are at
+// `data`. Returns its dimensions, or an invalid size if it is not a JPEG,
+// the header lies beyond `length`, or it is not a DCT one that Qt can
+// decode (lossless SOF3, as used for raw data, and the arithmetic-coded
+// variants).
+QSize jpegSize(const uchar *data, qint64 length)
+{
+    if (length < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return QSize();
+    qint64 pos = 2;
+    while (pos + 4 <= length) {
+        if (data[pos] != 0xFF)
+            return QSize();
+        const uchar marker = data[pos + 1];
+        if (marker == 0xFF) {           // fill byte
+            ++pos;
+            continue;
+        }
+        const qint64 segment = qint64(data[pos + 2]) << 8 | data[pos + 3];
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // Baseline, extended sequential and progressive Huffman only.
+            if (marker != 0xC0 && marker != 0xC1 && marker != 0xC2)
+                return QSize();
+            if (pos + 9 > length)
+                return QSize();
+            const int height = data[pos + 5] << 8 | data[pos + 6];
+            const int width = data[pos + 7] << 8 | data[pos + 8];
+            return width > 0 && height > 0 ? QSize(width, height) : QSize();
+        }
+        if (marker == 0xDA || marker == 0xD9 || segment < 2)
+            return QSize();
+        pos += 2 + segment;
+    }
+    return QSize();
+}
+
+// Dimensions of the JPEG stream at [offset, offset + length) of the file,
+// as jpegSize(); invalid if the stream does not fit in the file.
+using JpegProbe = std::function<QSize(qint64 offset, qint64 length)>;
+
+void consider(const JpegProbe &probe, qint64 offset, qint64 length, Candidate &best)
+{
+    const QSize size = probe(offset, length);
+    if (!size.isValid())
+        return;
+    if (qint64(size.width()) * size.height() > qint64(best.size.width()) * best.size.height()) {
+        best.offset = offset;
+        best.length = length;
+        best.size = size;
+    }
+}
+
+// Collect the JPEGs referenced by `ifd`: a JPEGInterchangeFormat pair, or
+// a single-strip JPEG-compressed image.
+void scanIfd(const TiffView &file, const JpegProbe &probe, quint32 ifd, Candidate &best)
+{
+    const quint32 jpegOffset = readTiffUInt(file, ifd, TAG_JPEG_OFFSET);
+    const quint32 jpegLength = readTiffUInt(file, ifd, TAG_JPEG_LENGTH);
+    if (jpegOffset && jpegLength)
+        consider(probe, jpegOffset, jpegLength, best);
+
+    const quint32 compression = readTiffUInt(file, ifd, TAG_COMPRESSION);
+    if (compression != COMPRESSION_OLD_JPEG && compression != COMPRESSION_JPEG)
+        return;
+    quint16 type = 0;
+    quint32 count = 0;
+    qint64 at = 0;
+    // Tiled or multi-strip images are raw data, not previews.
+    if (!findTiffTag(file, ifd, TAG_STRIP_OFFSETS, type, count, at) || count != 1)
+        return;
+    const quint32 stripOffset = readTiffUInt(file, ifd, TAG_STRIP_OFFSETS);
+    const quint32 stripLength = readTiffUInt(file, ifd, TAG_STRIP_BYTE_COUNTS);
+    if (stripOffset && stripLength)
+        consider(probe, stripOffset, stripLength, best);
+}
+
+Candidate findLargestJpeg(const TiffView &file, const JpegProbe &probe, quint32 ifd0)
+{
+    Candidate best;
+    std::vector<quint32> pending { ifd0 };
+    std::vector<quint32> seen;
+    while (!pending.empty() && int(seen.size()) < MAX_IFDS) {
+        const quint32 ifd = pending.back();
+        pending.pop_back();
+        if (ifd == 0 || !file.has(ifd, 2) || std::find(seen.begin(), seen.end(), ifd) != seen.end())
+            continue;
+        seen.push_back(ifd);
+        scanIfd(file, probe, ifd, best);
+
+        // SubIFDs (NEF, DNG, ARW previews and raw data), then the next IFD
+        // in the chain (CR2 keeps its previews in IFD0 to IFD2).
+        quint16 type = 0;
+        quint32 count = 0;
+        qint64 at = 0;
+        if (findTiffTag(file, ifd, TAG_SUB_IFDS, type, count, at)) {
+            for (quint32 i = 0; i < count && i < quint32(MAX_IFDS); ++i)
+                pending.push_back(file.u32(at + qint64(i) * 4));
+        }
+        const int entries = file.u16(ifd);
+        pending.push_back(file.u32(qint64(ifd) + 2 + qint64(entries) * 12));
+    }
+    return best;
+}
+
+// True if `path` lies on a fixed local disk, which is safe to map. The
+// answer is kept per directory; decode threads ask for every RAW.
+bool isMappable(const QString &path)
+{
+    static std::mutex mutex;
+    static QHash<QString, bool> byDirectory;
+    const QString directory = QFileInfo(path).absolutePath();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = byDirectory.constFind(directory);
+        if (it != byDirectory.constEnd())
+            return it.value();
+    }
+    const QByteArray type = QStorageInfo(directory).fileSystemType().toLower();
+    const bool mappable = std::any_of(std::begin(MAPPABLE_FILE_SYSTEMS), std::end(MAPPABLE_FILE_SYSTEMS),
+                                      [&](const char *local) { return type == local; });
+    std::lock_guard<std::mutex> lock(mutex);
+    byDirectory.insert(directory, mappable);
+    return mappable;
+}
+
+} // namespace
+
+bool TiffPreview::load(const QString &path, QImage &out, QSize maxSize, const std::atomic_bool *cancel)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < 8)
+        return false;
+    const qint64 size = file.size();
+    // Mapped where that is safe: only the IFDs and the chosen JPEG are
+    // paged in, and the JPEG is decoded straight out of the page cache.
+    // Elsewhere the IFD window, the candidates' headers and the chosen
+    // JPEG are read.
+    uchar *mapped = isMappable(path) ? file.map(0, size) : nullptr;
+    struct Unmap
+    {
+        QFile &file;
+        uchar *mapped;
+        ~Unmap()
+        {
+            if (mapped)
+                file.unmap(mapped);
+        }
+    } unmap { file, mapped };
+    QByteArray window;
+    if (!mapped) {
+        window = file.read(qMin(size, IFD_WINDOW));
+        if (window.size() < 8)
+            return false;
+    }
+    const uchar *head = mapped ? mapped : reinterpret_cast<const uchar *>(window.constData());
+
+    TiffView tiff { head, mapped ? size : qint64(window.size()), true };
+    if (head[0] == 'I' && head[1] == 'I')
+        tiff.littleEndian = true;
+    else if (head[0] == 'M' && head[1] == 'M')
+        tiff.littleEndian = false;
+    else
+        return false;
+    if (tiff.u16(2) != 42)
+        return false;       // ORF and RW2 use their own magic and layouts
+    const quint32 ifd0 = tiff.u32(4);
+
+    const JpegProbe probe = [&](qint64 offset, qint64 length) {
+        if (offset < 0 || length < 4 || offset + length > size)
+            return QSize();
+        const qint64 probed = qMin(length, JPEG_PROBE_BYTES);
+        if (tiff.has(offset, probed))
+            return jpegSize(tiff.data + offset, probed);
+        if (!file.seek(offset))
+            return QSize();
+        const QByteArray header = file.read(probed);
+        return jpegSize(reinterpret_cast<const uchar *>(header.constData()), header.size());
+    };
+    const Candidate best = findLargestJpeg(tiff, probe, ifd0);
+    if (!best.size.isValid())
+        return false;
+    const int edge = qMax(best.size.width(), best.size.height());
+    const int wanted = maxSize.isValid() && !maxSize.isEmpty() ? qMax(maxSize.width(), maxSize.height())
+                                                               : MIN_PREVIEW_EDGE;
+    if (edge < qMin(wanted, MIN_PREVIEW_EDGE))
+        return false;
+    if (cancel && cancel->load(std::memory_order_relaxed))
+        return false;
+
+    // Orientation applies after decoding, so bound the decode by the
+    // transposed size for previews that will be turned by 90 degrees.
+    const quint32 orientation = readTiffUInt(tiff, ifd0, TAG_ORIENTATION);
+    const bool quarterTurn = orientation >= 5 && orientation <= 8;
+
+    QByteArray jpeg;
+    if (mapped) {
+        // fromRawData() wraps the mapping without copying it; the mapping
+        // outlives the reader.
+        jpeg = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped + best.offset), best.length);
+    } else {
+        if (!file.seek(best.offset))
+            return false;
+        jpeg = file.read(best.length);
+        if (jpeg.size() != best.length)
+            return false;
+    }
+    QBuffer buffer(&jpeg);
+    if (!buffer.open(QIODevice::ReadOnly))
+        return false;
+    QImageReader reader(&buffer, "jpeg");
+    reader.setAutoTransform(false);
+    if (maxSize.isValid() && !maxSize.isEmpty()) {
+        const QSize bound = quarterTurn ? maxSize.transposed() : maxSize;
+        reader.setScaledSize(best.size.scaled(bound, Qt::KeepAspectRatio).boundedTo(best.size));
+    }
+    QImage image;
+    if (!reader.read(&image) || image.isNull())
+        return false;
+
+    // The eight EXIF orientations: 2 and 4 are mirror images, 5 and 7 a
+    // horizontal mirror followed by a quarter turn.
+    switch (orientation) {
+    case 2: image = image.mirrored(true, false); break;
+    case 3: image = image.transformed(QTransform().rotate(180)); break;
+    case 4: image = image.mirrored(false, true); break;
+    case 5: image = image.mirrored(true, false).transformed(QTransform().rotate(270)); break;
+    case 6: image = image.transformed(QTransform().rotate(90)); break;
+    case 7: image = image.mirrored(true, false).transformed(QTransform().rotate(90)); break;
+    case 8: image = image.transformed(QTransform().rotate(270)); break;
+    default: break;
+    }
+    out = std::move(image);
+    return true;
+}
@@ -0,0 +1,28 @@
+// tiffpreview.h
+//
+// Declares the fast path for TIFF-based RAW files (DNG, CR2, NEF, ARW, PEF
+// and friends): the file is memory-mapped, its IFD chain and SubIFDs are
+// walked for the largest embedded baseline JPEG, and that byte range is
+// handed to Qt's JPEG decoder in place, with no copy of the preview and
+// without LibRaw opening the file. Lossless JPEG streams (the raw data of
+// DNG and CR2) are recognised by their SOF3 marker and skipped. Files on
+// network shares and removable media are not mapped, since a read error
+// there would fault the process; their IFDs and preview are read instead.
+
+#pragma once
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+#include <atomic>
+
+namespace TiffPreview {
+    // Decode the largest embedded preview of `path`, bounded by `maxSize`
+    // if valid and turned upright by the IFD0 orientation. Fails (returning
+    // false) if the file is not a TIFF, has no usable JPEG, or its largest
+    // one is too small to stand in for the image at `maxSize`; the caller
+    // then falls back to LibRaw.
+    bool load(const QString &path, QImage &out, QSize maxSize = QSize(),
+              const std::atomic_bool *cancel = nullptr);
+}
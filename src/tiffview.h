@@ -0,0 +1,91 @@
+// tiffview.h
+//
+// Bounds-checked reading of TIFF structures, shared by the EXIF scanner
+// and the RAW preview extractor. Everything works on a borrowed byte range
+// (a header read into memory, the payload of a JPEG's Exif segment or a
+// memory-mapped file) without copying it, and an offset that points
+// outside the range reads as a missing value rather than faulting.
+
+#pragma once
+
+#include <QtGlobal>
+
+constexpr quint16 TIFF_ASCII = 2;
+constexpr quint16 TIFF_SHORT = 3;
+constexpr quint16 TIFF_LONG = 4;
+constexpr quint16 TIFF_RATIONAL = 5;
+
+// Size in bytes of one element of a TIFF field type.
+inline int tiffTypeSize(quint16 type)
+{
+    switch (type) {
+    case 3: case 8: return 2;                   // SHORT, SSHORT
+    case 4: case 9: case 11: case 13: return 4; // LONG, SLONG, FLOAT, IFD
+    case 5: case 10: case 12: return 8;         // RATIONAL, SRATIONAL, DOUBLE
+    default: return 1;                          // BYTE, ASCII, UNDEFINED, ...
+    }
+}
+
+// View of a TIFF structure. Offsets are relative to its start.
+struct TiffView
+{
+    const uchar *data = nullptr;
+    qint64 size = 0;
+    bool littleEndian = true;
+
+    bool has(qint64 offset, qint64 length) const
+    {
+        return offset >= 0 && length >= 0 && offset + length <= size;
+    }
+    quint16 u16(qint64 offset) const
+    {
+        if (!has(offset, 2))
+            return 0;
+        const uchar *p = data + offset;
+        return littleEndian ? quint16(p[0] | p[1] << 8) : quint16(p[0] << 8 | p[1]);
+    }
+    quint32 u32(qint64 offset) const
+    {
+        if (!has(offset, 4))
+            return 0;
+        const uchar *p = data + offset;
+        return littleEndian ? quint32(p[0]) | quint32(p[1]) << 8 | quint32(p[2]) << 16 | quint32(p[3]) << 24
+                            : quint32(p[0]) << 24 | quint32(p[1]) << 16 | quint32(p[2]) << 8 | quint32(p[3]);
+    }
+};
+
+// Locate `tag` in the IFD at `ifd` and return where its value starts (the
+// inline field for values up to four bytes) and its element count.
+inline bool findTiffTag(const TiffView &tiff, quint32 ifd, quint16 tag, quint16 &type, quint32 &count,
+                        qint64 &valueOffset)
+{
+    const int entries = tiff.u16(ifd);
+    if (entries <= 0 || !tiff.has(qint64(ifd) + 2, qint64(entries) * 12))
+        return false;
+    for (int i = 0; i < entries; ++i) {
+        const qint64 entry = qint64(ifd) + 2 + qint64(i) * 12;
+        if (tiff.u16(entry) != tag)
+            continue;
+        type = tiff.u16(entry + 2);
+        count = tiff.u32(entry + 4);
+        const qint64 bytes = qint64(count) * tiffTypeSize(type);
+        valueOffset = bytes <= 4 ? entry + 8 : qint64(tiff.u32(entry + 8));
+        return tiff.has(valueOffset, bytes);
+    }
+    return false;
+}
+
+// Unsigned integer value of a SHORT or LONG field, or 0.
+inline quint32 readTiffUInt(const TiffView &tiff, quint32 ifd, quint16 tag)
+{
+    quint16 type = 0;
+    quint32 count = 0;
+    qint64 at = 0;
+    if (!findTiffTag(tiff, ifd, tag, type, count, at) || count == 0)
+        return 0;
+    if (type == TIFF_SHORT)
+        return tiff.u16(at);
+    if (type == TIFF_LONG)
+        return tiff.u32(at);
+    return 0;
+}
@@ -0,0 +1,256 @@
+// undolog.cpp
+//
+// Spilled blocks are appended to the spill file as the raw slot array
+// followed by the block's name arena in UTF-16. Undo only ever reads back
+// the newest spilled block, so the file is used as a stack and truncated
+// as blocks are reloaded.
+
+#include "undolog.h"
+
+#include <QDebug>
+
+#include <type_traits>
+#include <utility>
+
+namespace {
+
+static_assert(sizeof(QChar) == 2, "name arenas are spilled as UTF-16");
+
+// Split `path` after its last separator, which stays with the directory,
+// so joining the parts gives back exactly the same string.
+void splitPath(const QString &path, QString *directory, QString *name)
+{
+    const qsizetype slash = path.lastIndexOf(QLatin1Char('/'));
+    *directory = path.left(slash + 1);
+    *name = path.mid(slash + 1);
+}
+
+} // namespace
+
+quint32 UndoLog::internDir(const QString &directory)
+{
+    auto it = m_dirIds.constFind(directory);
+    if (it != m_dirIds.constEnd())
+        return it.value();
+    const quint32 id = quint32(m_dirs.size());
+    m_dirs.append(directory);
+    m_dirIds.insert(directory, id);
+    return id;
+}
+
+void UndoLog::storeNames(Block &block, Slot &slot, const QString &name, const QString &destinationName)
+{
+    Q_ASSERT(name.size() <= 0xFFFF && destinationName.size() <= 0xFFFF);
+    slot.nameOffset = quint32(block.names.size());
+    slot.nameLength = quint16(name.size());
+    block.names += name;
+    if (destinationName == name) {
+        slot.destinationLength = 0;
+    } else {
+        slot.destinationLength = quint16(destinationName.size());
+        block.names += destinationName;
+    }
+}
+
+void UndoLog::push(const MoveAction &action)
+{
+    if (m_blocks.empty() || int(m_blocks.back().slots.size()) >= BLOCK_SLOTS) {
+        m_blocks.emplace_back();
+        m_blocks.back().slots.reserve(BLOCK_SLOTS);
+        if (int(m_blocks.size()) > RESIDENT_BLOCKS)
+            spillOldest();
+    }
+    Block &block = m_blocks.back();
+    QString sourceDir, name, destinationDir, destinationName;
+    splitPath(action.originalPath, &sourceDir, &name);
+    splitPath(action.destinationPath, &destinationDir, &destinationName);
+    Slot slot;
+    slot.taskId = action.taskId;
+    slot.journalId = action.journalId;
+    slot.sourceDir = internDir(sourceDir);
+    slot.destinationDir = internDir(destinationDir);
+    slot.index = action.index;
+    slot.state = action.state;
+    storeNames(block, slot, name, destinationName);
+    block.slots.push_back(slot);
+    ++m_size;
+    ++m_residentSize;
+}
+
+MoveAction UndoLog::pop()
+{
+    Q_ASSERT(m_residentSize > 0);
+    Block &block = m_blocks.back();
+    const Slot slot = block.slots.back();
+    const MoveAction action = unpack(block, slot);
+    // Names are appended in push order, so the newest entry's usually end
+    // the arena; setDestination() may have left a gap, reclaimed with the
+    // block.
+    if (slot.nameOffset + slot.nameLength + slot.destinationLength == quint32(block.names.size()))
+        block.names.truncate(slot.nameOffset);
+    block.slots.pop_back();
+    if (block.slots.empty())
+        m_blocks.pop_back();
+    --m_size;
+    --m_residentSize;
+    if (m_residentSize == 0)
+        reloadSpilled();
+    return action;
+}
+
+void UndoLog::clear()
+{
+    m_dirs.clear();
+    m_dirIds.clear();
+    m_blocks.clear();
+    m_size = 0;
+    m_residentSize = 0;
+    m_spilled.clear();
+    if (m_spill.isOpen())
+        m_spill.resize(0);
+}
+
+qsizetype UndoLog::findTask(quint64 taskId) const
+{
+    if (taskId == 0)
+        return -1;
+    qsizetype position = 0;
+    for (auto block = m_blocks.rbegin(); block != m_blocks.rend(); ++block) {
+        for (auto slot = block->slots.rbegin(); slot != block->slots.rend(); ++slot, ++position) {
+            if (slot->taskId == taskId)
+                return position;
+        }
+    }
+    return -1;
+}
+
+UndoLog::Slot &UndoLog::slotAt(qsizetype position, Block **block)
+{
+    const Block *found = nullptr;
+    Slot &slot = const_cast<Slot &>(std::as_const(*this).slotAt(position, &found));
+    if (block)
+        *block = const_cast<Block *>(found);
+    return slot;
+}
+
+const UndoLog::Slot &UndoLog::slotAt(qsizetype position, const Block **block) const
+{
+    Q_ASSERT(position >= 0 && position < m_residentSize);
+    auto it = m_blocks.rbegin();
+    while (position >= qsizetype(it->slots.size())) {
+        position -= qsizetype(it->slots.size());
+        ++it;
+    }
+    if (block)
+        *block = &*it;
+    return it->slots[it->slots.size() - 1 - size_t(position)];
+}
+
+MoveAction UndoLog::unpack(const Block &block, const Slot &slot) const
+{
+    const QStringView names(block.names);
+    const QStringView name = names.mid(slot.nameOffset, slot.nameLength);
+    MoveAction action;
+    action.originalPath = m_dirs.at(slot.sourceDir);
+    action.originalPath.append(name);
+    action.destinationPath = m_dirs.at(slot.destinationDir);
+    action.destinationPath.append(slot.destinationLength
+                                      ? names.mid(slot.nameOffset + slot.nameLength, slot.destinationLength)
+                                      : name);
+    action.index = slot.index;
+    action.taskId = slot.taskId;
+    action.state = slot.state;
+    action.journalId = slot.journalId;
+    return action;
+}
+
+MoveAction UndoLog::at(qsizetype position) const
+{
+    const Block *block = nullptr;
+    const Slot &slot = slotAt(position, &block);
+    return unpack(*block, slot);
+}
+
+void UndoLog::setState(qsizetype position, int state)
+{
+    slotAt(position).state = state;
+}
+
+void UndoLog::setDestination(qsizetype position, const QString &destinationPath)
+{
+    Block *block = nullptr;
+    Slot &slot = slotAt(position, &block);
+    const QString name = block->names.mid(slot.nameOffset, slot.nameLength);
+    QString destinationDir, destinationName;
+    splitPath(destinationPath, &destinationDir, &destinationName);
+    slot.destinationDir = internDir(destinationDir);
+    storeNames(*block, slot, name, destinationName);
+}
+
+void UndoLog::erase(qsizetype position)
+{
+    Block *block = nullptr;
+    Slot &slot = slotAt(position, &block);
+    block->slots.erase(block->slots.begin() + (&slot - block->slots.data()));
+    if (block->slots.empty()) {
+        for (auto it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+            if (&*it == block) {
+                m_blocks.erase(it);
+                break;
+            }
+        }
+    }
+    --m_size;
+    --m_residentSize;
+    if (m_residentSize == 0)
+        reloadSpilled();
+}
+
+void UndoLog::spillOldest()
+{
+    static_assert(std::is_trivially_copyable<Slot>::value, "slots are spilled as raw bytes");
+    if (!m_spill.isOpen() && !m_spill.open())
+        return;     // keep everything in memory instead
+    const Block &block = m_blocks.front();
+    Spilled spilled;
+    spilled.offset = m_spill.size();
+    spilled.slotCount = qint32(block.slots.size());
+    spilled.nameLength = qint32(block.names.size());
+    const qint64 slotBytes = qint64(block.slots.size()) * sizeof(Slot);
+    const qint64 nameBytes = qint64(block.names.size()) * 2;
+    if (!m_spill.seek(spilled.offset)
+        || m_spill.write(reinterpret_cast<const char *>(block.slots.data()), slotBytes) != slotBytes
+        || m_spill.write(reinterpret_cast<const char *>(block.names.constData()), nameBytes) != nameBytes) {
+        qWarning() << "UndoLog: cannot spill to" << m_spill.fileName() << m_spill.errorString();
+        return;
+    }
+    m_spilled.push_back(spilled);
+    m_residentSize -= qsizetype(block.slots.size());
+    m_blocks.pop_front();
+}
+
+bool UndoLog::reloadSpilled()
+{
+    if (m_spilled.empty())
+        return false;
+    const Spilled spilled = m_spilled.back();
+    m_spilled.pop_back();
+    Block block;
+    block.slots.resize(size_t(spilled.slotCount));
+    block.names.resize(spilled.nameLength);
+    const qint64 slotBytes = qint64(spilled.slotCount) * sizeof(Slot);
+    const qint64 nameBytes = qint64(spilled.nameLength) * 2;
+    if (!m_spill.seek(spilled.offset)
+        || m_spill.read(reinterpret_cast<char *>(block.slots.data()), slotBytes) != slotBytes
+        || m_spill.read(reinterpret_cast<char *>(block.names.data()), nameBytes) != nameBytes) {
+        // The older history is lost; what is resident stays usable.
+        qWarning() << "UndoLog: cannot read back" << m_spill.fileName() << m_spill.errorString();
+        m_size = m_residentSize;
+        m_spilled.clear();
+        return false;
+    }
+    m_spill.resize(spilled.offset);
+    m_residentSize += spilled.slotCount;
+    m_blocks.push_front(std::move(block));
+    return true;
+}
@@ -0,0 +1,114 @@
+// undolog.h
+//
+// Declares UndoLog, the window's undo history. History is unbounded, so it
+// is stored compactly: each move is a fixed 40-byte slot holding ids of
+// interned directories plus the offset of its file name in a per-block
+// character arena. Source and destination usually share a name, which is
+// then stored once. Slots live in blocks of BLOCK_SLOTS. Push and pop only
+// touch the newest block. Once more than RESIDENT_BLOCKS blocks are held,
+// the oldest block is spilled to a temporary file and read back when undo
+// reaches it, so a long session keeps only its recent history in memory.
+// Like ImageCache it is meant to be used from the GUI thread only.
+
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryFile>
+
+#include <deque>
+#include <vector>
+
+// Record of a move operation for undo purposes
+struct MoveAction
+{
+    QString originalPath;
+    QString destinationPath;
+    int index = 0;
+    // File worker handle of the move and its last reported state (a
+    // FileTaskState).
+    quint64 taskId = 0;
+    int state = 0;
+    // Id of the move in the folder's MoveJournal.
+    quint64 journalId = 0;
+};
+
+class UndoLog
+{
+public:
+    UndoLog() = default;
+
+    bool isEmpty() const { return m_size == 0; }
+    qsizetype size() const { return m_size; }
+
+    void push(const MoveAction &action);
+    // The newest entry, and the same with removal. The log must not be
+    // empty.
+    MoveAction top() const { return at(0); }
+    MoveAction pop();
+    void clear();
+
+    // Position of the entry for file worker task `taskId`, counted from the
+    // newest (0), or -1. Tasks still being worked on belong to recent
+    // moves, so the search starts there and never reads spilled blocks.
+    qsizetype findTask(quint64 taskId) const;
+
+    // Access to the resident entry at `position` (as returned by
+    // findTask()).
+    MoveAction at(qsizetype position) const;
+    void setState(qsizetype position, int state);
+    void setDestination(qsizetype position, const QString &destinationPath);
+    // Remove an entry from the middle of the history. Linear in the size of
+    // its block; only needed for failed moves.
+    void erase(qsizetype position);
+
+private:
+    struct Slot
+    {
+        quint64 taskId;
+        quint64 journalId;
+        quint32 nameOffset;         // into Block::names
+        quint16 nameLength;
+        quint16 destinationLength;  // 0: same name as the source
+        quint32 sourceDir;          // into m_dirs
+        quint32 destinationDir;
+        qint32 index;
+        qint32 state;
+    };
+
+    struct Block
+    {
+        std::vector<Slot> slots;
+        QString names;
+    };
+
+    // Where a spilled block sits in m_spill.
+    struct Spilled
+    {
+        qint64 offset;
+        qint32 slotCount;
+        qint32 nameLength;
+    };
+
+    static constexpr int BLOCK_SLOTS = 1024;
+    static constexpr int RESIDENT_BLOCKS = 4;
+
+    quint32 internDir(const QString &directory);
+    // Store the names of `slot` at the end of `block`'s arena.
+    static void storeNames(Block &block, Slot &slot, const QString &name, const QString &destinationName);
+    Slot &slotAt(qsizetype position, Block **block = nullptr);
+    const Slot &slotAt(qsizetype position, const Block **block = nullptr) const;
+    MoveAction unpack(const Block &block, const Slot &slot) const;
+    void spillOldest();
+    bool reloadSpilled();
+
+    QStringList m_dirs;
+    QHash<QString, quint32> m_dirIds;
+    // Resident blocks, oldest first; entries in spilled blocks precede them.
+    std::deque<Block> m_blocks;
+    qsizetype m_size = 0;
+    qsizetype m_residentSize = 0;
+    std::vector<Spilled> m_spilled;
+    QTemporaryFile m_spill;
+};